@@ -4,7 +4,7 @@ shopt -s extglob
 mkdir -p build
 pushd build
 SRC=$(ls -t ../src/*.c)
-CFLAGS+=("-Wall -std=c11 -I ../include")
+CFLAGS+=("-Wall -std=c11 -pthread -I ../include")
 CFLAGS_IJDB=("-l readline")
 
 $CC \
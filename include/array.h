@@ -3,20 +3,68 @@
 
 
 #include <stdlib.h> // calloc
+#include <sys/types.h> // off_t
 
 
 #include "types.h"
 #include "config.h"
 #include "cpu.h"
 #include "terminate.h"
+#include "marr.h"
+#include "scan.h"
+#include "gcpar.h"
+#include "stackmap.h"
+#include "prof.h"
+#include "io.h"
+#include "net.h"
+#include "thread.h"
 
 
 /**
 * Create a new array.
+* If 'frame' is not -1 the array is local to the frame with that frame pointer: it may be taken
+* from the frame region and is then removed by arr_release_frame instead of the garbage collector.
 * Return  array reference on success
 *         0 on failure
 **/
-word_t arr_create(const word_t count);
+word_t arr_create(const word_t count, const int32_t frame);
+
+
+/**
+* Create a new array of bytes (elements take one byte each and never hold references).
+* 'frame' is the same as for arr_create.
+* Return  array reference
+**/
+word_t arr_create_bytes(const word_t count, const int32_t frame);
+
+
+/**
+* Create a new multidimensional array stored as one contiguous row-major block of words.
+* 'sizes' holds the size of each of the 'num_dims' dimensions (outermost first).
+* 'frame' is the same as for arr_create.
+* Return  array reference
+**/
+word_t arr_create_multi(const uint32_t num_dims, const word_t* sizes, const int32_t frame);
+
+
+/**
+* Create a byte array holding 'head' (input that was already read) followed by everything left to
+* read from a file descriptor: a regular file from offset 'pos' on, anything else (a pipe or
+* terminal, 'pos' is -1) until its end.
+* Without a head, the rest of a regular file is mapped copy-on-write, so bytes are only read once
+* they are accessed and stores never reach the file. Otherwise the input is read into a new array.
+* Return  array reference
+*         0 if nothing was left to read
+**/
+word_t arr_create_file(const int fd, const off_t pos, const byte_t* head, const size_t head_len);
+
+
+/**
+* Check indices (outermost first) into an array created by arr_create_multi against the size of
+* every dimension.
+* Return  index of the element in the flat (row-major) array, for use with arr_get and arr_set
+**/
+word_t arr_multi_index(const word_t arr_ref, const uint32_t num_dims, const word_t* indices);
 
 
 /**
@@ -31,6 +79,91 @@ word_t arr_get(const word_t arr_ref, const word_t i);
 void arr_set(const word_t arr_ref, const word_t i, const word_t val);
 
 
+/**
+* Get a value (0 to 255) from a byte array
+**/
+word_t arr_get_byte(const word_t arr_ref, const word_t i);
+
+
+/**
+* Change value inside a byte array (only the lowest 8 bits of the value are kept)
+**/
+void arr_set_byte(const word_t arr_ref, const word_t i, const word_t val);
+
+
+/**
+* Copy 'len' elements of array 'src_ref' starting at 'src_pos' into array 'dst_ref' starting at
+* 'dst_pos'. Both ranges are bounds checked once and may overlap.
+* Both arrays must be of the same kind (both word arrays or both byte arrays).
+**/
+void arr_copy(const word_t src_ref, const word_t src_pos, const word_t dst_ref, const word_t dst_pos, const word_t len);
+
+
+/**
+* Set elements from 'from' up to (excluding) 'to' to 'val'
+**/
+void arr_fill(const word_t arr_ref, const word_t from, const word_t to, const word_t val);
+
+
+/**
+* Read up to 'len' bytes of input into the elements of an array starting at 'from' (one byte per
+* element for word arrays, at most BUFSIZ bytes at a time). Only waits for input if none is buffered.
+* Elements past the number of bytes read are left unchanged.
+* Return  number of bytes read (0 once the input has ended)
+**/
+word_t arr_input(const word_t arr_ref, const word_t from, const word_t len);
+
+
+/**
+* Write 'len' elements of an array starting at 'from' to the output (the lowest 8 bits of each)
+**/
+void arr_output(const word_t arr_ref, const word_t from, const word_t len);
+
+
+/**
+* Receive up to 'len' bytes from a network reference into the elements of an array starting at
+* 'from' (one byte per element for word arrays, at most BUFSIZ bytes at a time), see net_recv_bytes.
+* Elements past the number of bytes received are left unchanged.
+* Return  number of bytes received, or NET_WOULD_BLOCK
+**/
+word_t arr_net_input(const word_t arr_ref, const word_t from, const word_t len, const word_t net_ref);
+
+
+/**
+* Send 'len' elements of an array starting at 'from' to a network reference (the lowest 8 bits
+* of each), see net_send_bytes.
+* Return  number of bytes sent
+**/
+word_t arr_net_output(const word_t arr_ref, const word_t from, const word_t len, const word_t net_ref);
+
+
+#ifdef GC_TAGS
+/**
+* Same as arr_get but also return the tag of the element (true if it holds an array reference)
+**/
+word_t arr_get_tagged(const word_t arr_ref, const word_t i, bool* tag);
+
+
+/**
+* Same as arr_set but also set the tag of the element
+**/
+void arr_set_tagged(const word_t arr_ref, const word_t i, const word_t val, const bool tag);
+
+
+/**
+* Same as arr_fill but also set the tags of the elements
+**/
+void arr_fill_tagged(const word_t arr_ref, const word_t from, const word_t to, const word_t val, const bool tag);
+#endif
+
+
+/**
+* Remove the arrays local to the frame with frame pointer 'frame' and to any frame above it.
+* Must be called whenever a frame is removed.
+**/
+void arr_release_frame(const int32_t frame);
+
+
 /**
 * Free all arrays and related data
 **/
@@ -43,6 +176,13 @@ void arr_destroy(void);
 uint32_t arr_gc(void);
 
 
+/**
+* Mark unreachable arrays but leave freeing them to subsequent array creations
+* (each creation sweeps a few slots) or to the next collection
+**/
+void arr_gc_lazy(void);
+
+
 /**
 * Print out all active array references
 **/
@@ -31,12 +31,36 @@
 #define OP_IALOAD         ((byte_t) 0xD2)
 #define OP_IASTORE        ((byte_t) 0xD3)
 #define OP_GC             ((byte_t) 0xD4)
+#define OP_ARRAYCOPY      ((byte_t) 0xD5)
+#define OP_ARRAYFILL      ((byte_t) 0xD6)
+#define OP_NEWBYTEARRAY   ((byte_t) 0xD7)
+#define OP_BALOAD         ((byte_t) 0xD8)
+#define OP_BASTORE        ((byte_t) 0xD9)
+#define OP_MULTINEWARRAY  ((byte_t) 0xDA)
+#define OP_MALOAD         ((byte_t) 0xDB)
+#define OP_MASTORE        ((byte_t) 0xDC)
+#define OP_INMAP          ((byte_t) 0xDD)
+#define OP_INARRAY        ((byte_t) 0xDE)
+#define OP_OUTARRAY       ((byte_t) 0xDF)
 
 #define OP_NETBIND        ((byte_t) 0xE1)
 #define OP_NETCONNECT     ((byte_t) 0xE2)
 #define OP_NETIN          ((byte_t) 0xE3)
 #define OP_NETOUT         ((byte_t) 0xE4)
 #define OP_NETCLOSE       ((byte_t) 0xE5)
+#define OP_NETLISTEN      ((byte_t) 0xE6)
+#define OP_NETACCEPT      ((byte_t) 0xE7)
+#define OP_NETPOLL        ((byte_t) 0xE8)
+#define OP_NETINARRAY     ((byte_t) 0xE9)
+#define OP_NETOUTARRAY    ((byte_t) 0xEA)
+
+#define OP_SPAWN          ((byte_t) 0xF1)
+#define OP_YIELD          ((byte_t) 0xF2)
+#define OP_JOIN           ((byte_t) 0xF3)
+
+// Internal fused instructions, produced by fuse_code when a program is loaded
+#define OP_FUSED_IALOAD   ((byte_t) 0xC0)
+#define OP_FUSED_IASTORE  ((byte_t) 0xC1)
 
 
 #endif
@@ -25,21 +25,149 @@
 * which means 16^5 = 1048576 unique array references
 **/
 #define ARRAYS_MAX_NUM 1048576 // Elements
+/**
+* Number of recently accessed arrays remembered so that accessing them again skips looking them up.
+* Must be a power of 2.
+**/
+#define ARRAYS_CACHE_NUM 4 // Arrays
+/**
+* Maximum number of dimensions of an array created by MULTINEWARRAY
+**/
+#define ARRAYS_MAX_DIMS 8 // Dimensions
+/**
+* Arrays taking up at least this much memory are mapped directly with mmap (and released with
+* munmap) instead of coming from calloc, so their pages are only committed once touched.
+**/
+#define ARRAYS_MMAP_MIN_SIZE 2097152 // Bytes
+/**
+* Size of the region arrays that never outlive their frame are allocated from. Once it is full
+* such arrays come from the heap like any other.
+**/
+#define ARRAYS_FRAME_REGION_SIZE 1048576 // Bytes
+
+
+/**
+* The garbage collector marks in parallel once at least this many arrays exist.
+* Below it the cost of waking up workers outweighs the gain so marking stays single-threaded.
+**/
+#define GC_PARALLEL_MIN_ARRAYS 32768 // Arrays
+/**
+* Upper limit on the number of threads marking in parallel (the calling thread included)
+**/
+#define GC_PARALLEL_MAX_THREADS 8 // Threads
+/**
+* Arrays larger than this are split into chunks of this many elements when marking in parallel
+* so a single huge array can be scanned by several workers.
+* Must be a multiple of 32 (so chunks start at whole words of a tag bitmap).
+**/
+#define GC_PARALLEL_CHUNK 4096 // Elements
+/**
+* A collection is started periodically, every time this many arrays were created on the heap
+* (arrays local to a frame are not counted).
+**/
+#define GC_PERIOD 100 // Arrays
+/**
+* Unreachable arrays found by a periodic collection are freed lazily. Every array creation
+* examines up to this many arrays (stopping at the first dead one) and the rest is swept
+* at the start of the next collection.
+**/
+#define GC_LAZY_SWEEP_SLOTS 256 // Slots
+/**
+* Methods whose local variables plus operand stack need more slots than this are not analysed
+* for stack maps, their frames are always scanned conservatively.
+* Must be a multiple of 32.
+**/
+#define SMAP_MAX_SLOTS 256 // Slots
+
+
+/**
+* Output of OUT is collected in a buffer of this size and written out once it is full, when the
+* program halts, stops with an error, or the VM is destroyed (and at every newline on a terminal)
+**/
+#define IO_OUT_BUFFER_SIZE 65536 // Bytes
+/**
+* Input that is not a regular file (a pipe, socket, or terminal) is read this many bytes at a
+* time. Regular files are mapped instead.
+**/
+#define IO_IN_BUFFER_SIZE 65536 // Bytes
+
+
+/**
+* The heap profiler (enabled by setting IJVM_HEAP_PROFILE to the path of its report) records one
+* array creation out of this many on average. Gaps between samples are random so periodic
+* allocation patterns are not over or under sampled. Counts and bytes are scaled back up by it.
+**/
+#define PROF_SAMPLE_EVERY 64 // Arrays
+/**
+* Number of allocation sites listed in each ranking of the heap profile
+**/
+#define PROF_TOP_SITES 20 // Sites
+/**
+* Arrays that survived this many collections or more share the last bucket of the survival histogram
+**/
+#define PROF_MAX_SURVIVALS 16 // Collections
 
 
 /**
-* Start at this number of connections then resize if necessary
+* Start at this number of connections then double if necessary
 **/
 #define NET_CONN_MIN_NUM 16 // Connections
 /**
-* From EE00000E to EEFFFFFE (inclusive)
+* From CC00000C to CCFFFFFC (inclusive)
 * which means 16^5 = 1048576 unique network references
 **/
-#define NET_CONN_MAX_NUM 128 // Connnections
+#define NET_CONN_MAX_NUM 1048576 // Connnections
 /**
 * Maximum queue length for pending connections
 **/
 #define NET_MAX_BACKLOG 1
+/**
+* Maximum queue length for pending connections of listening sockets (NETLISTEN)
+**/
+#define NET_LISTEN_BACKLOG 1024
+/**
+* Longest time NETCLOSE waits for the peer of a non-blocking connection to take pending output
+**/
+#define NET_CLOSE_TIMEOUT 1000 // Milliseconds
+/**
+* Maximum number of events taken from epoll at once by NETPOLL
+**/
+#define NET_POLL_EVENTS 256 // Events
+/**
+* Number of entries of the submission queue of io_uring (IJVM_IO_URING)
+**/
+#define URING_ENTRIES 256 // Requests
+/**
+* Number of buffers io_uring receives network data into (must be a power of two)
+**/
+#define URING_RECV_BUFFERS 256 // Buffers
+/**
+* Size of each buffer io_uring receives network data into
+**/
+#define URING_RECV_BUFFER_SIZE 16384 // Bytes
+/**
+* Size of the receive and send buffers of every connection
+**/
+#define NET_BUFFER_SIZE 65536 // Bytes
+
+
+/**
+* The table of threads starts at this size and grows when a thread is spawned while it is full
+**/
+#define THREADS_MIN_NUM 16 // Threads
+/**
+* From BB00000B to BBFFFFFB (inclusive)
+* which means 16^5 = 1048576 unique thread references
+**/
+#define THREADS_MAX_NUM 1048576 // Threads
+/**
+* Initial stack size of a spawned thread, it is resized like the stack of the main thread
+**/
+#define THREAD_STACK_MIN_SIZE 512 // Elements
+/**
+* Maximum number of events taken from epoll at once while all threads are parked
+**/
+#define THREAD_POLL_EVENTS 256 // Events
 
 
 #endif
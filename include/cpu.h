@@ -21,6 +21,9 @@ typedef struct CPU_t
     word_t* const_mem;
     byte_t* code_mem;
     word_t* stack;
+#ifdef GC_TAGS
+    uint32_t* stack_tags; // One tag bit per stack word
+#endif
 
     int pc;
     int sp;
@@ -33,13 +36,37 @@ typedef struct CPU_t
 }CPU_t;
 
 
+#ifdef GC_TAGS
+/**
+* Number of 32-bit words needed to hold tag bits of 'num' words
+**/
+#define TAG_WORDS(num) (((uint32_t)(num) + 31) / 32)
+
+
+/**
+* Tag bitmaps keep one bit per word which is set if and only if the word holds an array reference
+* (one returned by arr_create, or a copy of one)
+**/
+static inline bool tag_get(const uint32_t* tags, const uint32_t i)
+{
+    return ((tags[i / 32] >> (i % 32)) & 1) != 0;
+}
+
+
+static inline void tag_set(uint32_t* tags, const uint32_t i, const bool tag)
+{
+    tags[i / 32] = (tags[i / 32] & ~(1u << (i % 32))) | ((uint32_t)tag << (i % 32));
+}
+#endif
+
+
 extern CPU_t* restrict g_cpu; // One CPU shared across the entire machine
 extern FILE* restrict g_out_file;
 extern FILE* restrict g_in_file;
 
 
 /**
-* Pushes element on top of stack
+* Pushes element on top of stack (untagged, i.e. not a reference)
 * Returns  true on success
 *          false on failure
 **/
@@ -52,6 +79,12 @@ bool stack_push(const word_t e);
 word_t stack_pop(void);
 
 
+/**
+* Returns top element of the stack without popping it
+**/
+word_t stack_peek(void);
+
+
 /**
 * Returns the i'th constant from constant memory
 **/
@@ -43,6 +43,14 @@ extern DebugData_t* g_debug_data;
 bool load_debug_data(const char* prog_path);
 
 
+/**
+* Load a program's debug data into 'data' (which must be empty) without printing anything.
+* Return  true on success
+*         false on failure ('data' is left empty)
+**/
+bool read_debug_data(const char* prog_path, DebugData_t* data);
+
+
 /**
 * Initialize debug data
 **/
@@ -55,6 +63,12 @@ void init_debug_data(void);
 void destroy_debug_data(void);
 
 
+/**
+* Remove debug data loaded by read_debug_data from memory and leave it empty
+**/
+void free_debug_data(DebugData_t* data);
+
+
 /**
 * Return the i'th function name from debug data
 **/
@@ -0,0 +1,31 @@
+#ifndef FUSE_H
+#define FUSE_H
+
+
+#include "types.h"
+#include "cpu.h"
+#include "bytecode.h"
+#include "stackmap.h"
+#include "util.h"
+
+
+/**
+* Replace common array access sequences in code memory with fused instructions.
+* "ILOAD i; ILOAD a; IALOAD" becomes FUSED_IALOAD and "ILOAD i; ILOAD a; IASTORE" becomes
+* FUSED_IASTORE. Only the first byte of a sequence is rewritten so jumps into the middle of a
+* sequence still execute the original instructions. Sequences are fused only where the stack map
+* analysis proved that all three bytes are op-codes (never inside a method whose analysis failed).
+* Fused instructions still check the array reference and index on every access: the ISA can not load
+* the length of an array, so range checks can not be hoisted out of loops. Must be called after
+* smap_build.
+**/
+void fuse_code(void);
+
+
+/**
+* Enable or disable fusing (e.g. a debugger needs code memory to stay as it was loaded)
+**/
+void fuse_set_enabled(const bool enabled);
+
+
+#endif
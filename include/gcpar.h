@@ -0,0 +1,47 @@
+#ifndef GCPAR_H
+#define GCPAR_H
+
+
+#include <pthread.h>
+
+
+#include "types.h"
+#include "config.h"
+#include "scan.h"
+
+
+/**
+* Resolve a word that looks like a reference.
+* Return  pointer to the elements of the referenced array (and set index, element count, and
+*         the tag bitmap of the elements or NULL if elements are not tagged)
+*         NULL if the word does not reference an existing array
+* Must be safe to call from several threads at once.
+**/
+typedef const word_t* (*GcResolve_t)(const word_t ref, uint32_t* arr_i, uint32_t* num_els, const uint32_t** tags);
+
+
+/**
+* Mark, in parallel, every array reachable from the root words.
+* The roots are partitioned across the worker pool, reachable arrays are put on per-worker
+* work queues (large arrays are split into chunks) which idle workers steal from.
+* Mark bits are set atomically so 'marked' must have one entry per array index.
+* If 'root_tags' (or the tags of an array) is not NULL only tagged words are scanned,
+* otherwise every word is tested against the mask and pattern.
+**/
+void gcpar_mark(const word_t* roots, const uint32_t* root_tags, const uint32_t num_roots, bool* marked,
+    const uint32_t mask, const uint32_t pattern, GcResolve_t resolve);
+
+
+/**
+* Return the number of threads (including the calling one) used by gcpar_mark
+**/
+uint32_t gcpar_num_workers(void);
+
+
+/**
+* Stop and join all worker threads
+**/
+void gcpar_destroy(void);
+
+
+#endif
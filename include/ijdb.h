@@ -14,6 +14,7 @@
 #include "terminate.h"
 #include "interpreter.h"
 #include "debug_data_loader.h"
+#include "fuse.h"
 
 
 #define OUT_FILE "ijdb_program_output.txt" // Program output is redirected to outside of the console
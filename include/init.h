@@ -8,6 +8,11 @@
 #include "util.h"
 #include "interpreter.h"
 #include "terminate.h"
+#include "scan.h"
+#include "stackmap.h"
+#include "fuse.h"
+#include "prof.h"
+#include "io.h"
 
 
 /**
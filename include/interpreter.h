@@ -9,6 +9,7 @@
 #include "init.h"
 #include "array.h"
 #include "net.h"
+#include "thread.h"
 
 
 /**
@@ -0,0 +1,109 @@
+#ifndef IO_H
+#define IO_H
+
+
+#include <unistd.h> // isatty, read
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <poll.h> // poll
+
+
+#include "types.h"
+#include "config.h"
+#include "cpu.h"
+#include "array.h"
+#include "uring.h"
+#include "thread.h"
+
+
+extern const byte_t* g_in_pos; // Next input byte
+extern const byte_t* g_in_end; // End of the input available without calling io_refill
+
+
+/**
+* Flush pending output then send all further output to a file.
+* Output to a terminal is also flushed at every newline. Output to anything else is written by
+* io_uring if IJVM_IO_URING is set (and the kernel supports it) or by a separate thread if
+* IJVM_ASYNC_OUTPUT is set.
+**/
+void io_set_output(FILE* f);
+
+
+/**
+* Append a byte to the output buffer, the buffer is written out once full
+**/
+void io_put(const byte_t c);
+
+
+/**
+* Append bytes to the output buffer. Large writes skip the buffer (after flushing it).
+**/
+void io_write(const byte_t* src, const uint32_t len);
+
+
+/**
+* Write out all buffered output (and wait for the writer thread to write it)
+**/
+void io_flush(void);
+
+
+/**
+* Read input from a file from now on. Nothing is read until the first input is requested.
+**/
+void io_set_input(FILE* f);
+
+
+/**
+* Called once all available input was consumed.
+* The first time it is called regular files are mapped and everything else gets a buffer which
+* is refilled by reading as much as is available. With io_uring the next read is already under
+* way while the input of the last one is consumed. Output to a terminal is flushed before
+* reading so prompts are shown before waiting.
+* Return  next input byte
+*         EOF if there is no input left
+**/
+int32_t io_refill(void);
+
+
+/**
+* Return  next input byte
+*         EOF if there is no input left
+**/
+static inline int32_t io_get(void)
+{
+    return g_in_pos < g_in_end ? *g_in_pos++ : io_refill();
+}
+
+
+/**
+* Used by threads before reading input, does not wait.
+* Return  file descriptor to wait on for 'events' (epoll events, 0 if io_uring wakes the thread)
+*         -1 if reading input would not wait
+**/
+int io_wait_fd(uint32_t* events);
+
+
+/**
+* Copy up to 'max' bytes of input to 'dst'. Only waits for input if none is buffered,
+* so fewer bytes may be copied even though the input has not ended.
+* Return  number of bytes copied
+*         0 if there is no input left (or 'max' is 0)
+**/
+uint32_t io_read(byte_t* dst, const uint32_t max);
+
+
+/**
+* Create a byte array holding all input that is left (see arr_create_file), the input is then at its end.
+* Return  array reference
+*         0 if there was no input left
+**/
+word_t io_map_input(void);
+
+
+/**
+* Write out all buffered output, stop buffering, and release the input
+**/
+void io_destroy(void);
+
+
+#endif
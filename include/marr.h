@@ -22,6 +22,11 @@ typedef struct MappedArray_t
     uint32_t size;
     bool* map;
     uintptr_t* values;
+    uint32_t* live; // Indices of all claimed elements (in no particular order)
+    uint32_t* live_pos; // Position of every claimed index in 'live'
+    uint32_t num_live;
+    uint32_t* free_indices; // Stack of all unclaimed indices, the next one claimed is on top
+    uint32_t num_free;
 }MArr_t;
 
 
@@ -35,12 +40,19 @@ void marr_init(MArr_t* marr, const uint32_t size);
 
 /**
 * Resize map and values memory to a new size.
-* Mapped arrays can get bigger but never smaller.
+* Mapped arrays can only get smaller if no claimed element is cut off.
 * Size must be strictly less than SIZE_MAX_UINT32_T.
 **/
 void marr_resize(MArr_t* marr, const uint32_t new_size);
 
 
+/**
+* Halve the size (down to 'min_size') for as long as all claimed elements fit in a quarter of it.
+* Elements never move, so only unclaimed elements above the highest claimed one are released.
+**/
+void marr_shrink(MArr_t* marr, const uint32_t min_size);
+
+
 /**
 * Return the "claimed" state of an element from the map
 **/
@@ -48,17 +60,18 @@ bool marr_check_marked(const MArr_t* marr, const uint32_t val_i);
 
 
 /**
-* Add an entry (no matter where) to the mapped array.
+* Add an entry (no matter where) to the mapped array, takes constant time.
 * Return  index claimed for the new entry
 *         SIZE_MAX_UINT32_T if a free name was not found
 **/
-uint32_t marr_add_element(const MArr_t* marr, const uintptr_t data);
+uint32_t marr_add_element(MArr_t* marr, const uintptr_t data);
 
 
 /**
 * Update a value in the mapped array.
+* Claiming an unclaimed element this way takes time linear in the number of unclaimed ones.
 **/
-void marr_set_element(const MArr_t* marr, const uint32_t val_i, const uintptr_t data);
+void marr_set_element(MArr_t* marr, const uint32_t val_i, const uintptr_t data);
 
 
 /**
@@ -71,7 +84,7 @@ uintptr_t marr_get_element(const MArr_t* marr, const uint32_t val_i);
 /**
 * Properly remove an element from the mapped array
 **/
-void marr_remove_element(const MArr_t* marr, const uint32_t val_i);
+void marr_remove_element(MArr_t* marr, const uint32_t val_i);
 
 
 /**
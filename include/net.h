@@ -2,16 +2,33 @@
 #define NET_H
 
 
-#include <sys/socket.h> // socket
+#include <sys/socket.h> // socket, sendmsg
+#include <sys/uio.h> // iovec
 #include <arpa/inet.h> // htons, htonl
 #include <unistd.h> // read
+#include <errno.h> // EINTR, EAGAIN
+#include <fcntl.h> // fcntl
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <poll.h> // poll
+#include <time.h> // clock_gettime
 
 
 #include "types.h"
 #include "cpu.h"
 #include "util.h"
 #include "terminate.h"
-#include "marr.h"
+#include "uring.h"
+#include "thread.h"
+
+
+/**
+* Pushed by NETIN on a non-blocking connection that has no data yet
+**/
+#define NET_WOULD_BLOCK (-256)
+/**
+* Pushed by NETIN on a non-blocking connection that was closed by the peer or failed
+**/
+#define NET_END_OF_STREAM (-257)
 
 
 typedef struct Sock_t
@@ -22,6 +39,28 @@ typedef struct Sock_t
     bool server;
     struct sockaddr_in addr;
     socklen_t addr_len;
+    byte_t* recv_buf; // Received bytes not taken by NETIN yet (NULL until first received)
+    uint32_t recv_pos;
+    uint32_t recv_len;
+    uint32_t recv_cap; // Size of recv_buf, only grows for connections served by io_uring
+    byte_t* send_buf; // Bytes of NETOUT not sent yet (NULL until first sent)
+    uint32_t send_len;
+    uint32_t send_cap; // Size of send_buf, only grows for non-blocking connections
+    word_t ref; // Network reference of the socket
+    bool listener; // Created by NETLISTEN, NETACCEPT takes its connections
+    bool nonblock; // Created by NETLISTEN or NETACCEPT, never blocks and is watched by NETPOLL
+    bool queued; // Waiting to be returned by NETPOLL
+    bool event; // Reported ready by epoll (not only holding received bytes)
+    bool out_armed; // Watched for being writable because output is pending
+    uint32_t pending_i; // Index in the list of connections with pending output (or SIZE_MAX_UINT32_T)
+    bool ring; // Non-blocking socket served by io_uring instead of epoll
+    bool closed; // Closed by the program, freed once none of its requests is under way
+    bool eof; // io_uring reported the end of the stream (or an error)
+    uint32_t ring_ops; // Requests under way
+    byte_t* flight_buf; // Output handed to a send request, NETOUT appends to send_buf meanwhile
+    uint32_t flight_cap;
+    uint32_t flight_len; // Bytes to send (0 if no send request is under way)
+    uint32_t flight_done;
 }Sock_t;
 
 
@@ -41,27 +80,92 @@ word_t net_bind(const word_t port);
 word_t net_connect(const word_t host, const word_t port);
 
 
+/**
+* Create a new non-blocking socket listening on a given port (with a backlog of
+* NET_LISTEN_BACKLOG connections) that is watched by net_poll.
+* Return  network reference on success
+*         0 on failure
+**/
+word_t net_listen(const word_t port);
+
+
+/**
+* Take a connection waiting on a listening socket. The connection is non-blocking and watched
+* by net_poll.
+* Return  network reference of the connection
+*         0 if no connection is waiting
+**/
+word_t net_accept(const word_t net_ref);
+
+
+/**
+* Wait up to 'timeout' milliseconds (forever if negative) for a listening socket to have a
+* waiting connection or a non-blocking connection to have input (data, end of stream, or an
+* error). Pending output of non-blocking connections is sent first.
+* Return  network reference of the ready socket
+*         0 if none became ready or no socket is watched
+**/
+word_t net_poll(const word_t timeout);
+
+
 /**
 * Receive one character on a socket with a given network reference.
+* Characters are received NET_BUFFER_SIZE at a time and pending output of the socket is sent
+* before waiting for more.
 * Return  received character
+*         NET_WOULD_BLOCK or NET_END_OF_STREAM for non-blocking connections
 **/
-char net_recv(const word_t net_ref);
+word_t net_recv(const word_t net_ref);
 
 
 /**
-* Send one character on a socket with a given network reference
+* Send one character (as a whole word) on a socket with a given network reference.
+* Words are collected and sent once NET_BUFFER_SIZE bytes are pending, before the socket waits
+* for input, or when it is closed. Non-blocking connections also send them on net_poll and
+* keep what the peer does not take yet.
 **/
 void net_send(const word_t net_ref, const word_t data);
 
 
 /**
-* Close and delete a socket.
+* Used by threads before NETIN, NETINARRAY, and NETACCEPT, does not wait. Received data is taken
+* into the receive buffer and pending output is sent as far as the peer takes it.
+* Return  file descriptor to wait on for 'events' (epoll events, 0 if io_uring wakes the thread)
+*         -1 if the instruction would not wait
+**/
+int net_wait_fd(const word_t net_ref, uint32_t* events);
+
+
+/**
+* Receive up to 'max' bytes on a socket with a given network reference into 'dst'. Bytes received
+* already are taken first, otherwise a single recv receives straight into 'dst' (a blocking
+* connection sends its pending output and waits for data).
+* Return  number of bytes received (0 once the stream ended or failed, or if 'max' is 0)
+*         NET_WOULD_BLOCK for a non-blocking connection without data
+**/
+word_t net_recv_bytes(const word_t net_ref, byte_t* dst, const uint32_t max);
+
+
+/**
+* Send 'len' bytes on a socket with a given network reference after its pending output.
+* Bytes that do not fit in the send buffer of a blocking connection are sent along with the
+* pending output by a single sendmsg. A non-blocking connection keeps what the peer does not
+* take yet (like for net_send).
+* Return  number of bytes sent or kept (fewer only if a blocking connection failed)
+**/
+word_t net_send_bytes(const word_t net_ref, const byte_t* src, const uint32_t len);
+
+
+/**
+* Close and delete a socket. Pending output of a non-blocking connection is sent first, waiting
+* up to NET_CLOSE_TIMEOUT milliseconds for the peer to take it; whatever is left then is dropped.
 **/
 void net_close(const word_t net_ref);
 
 
 /**
-* Close all sockets and free all associated memory
+* Close all sockets and free all associated memory. Pending output is sent like for net_close, but
+* NET_CLOSE_TIMEOUT limits the wait for all sockets together.
 **/
 void net_destroy(void);
 
@@ -0,0 +1,70 @@
+#ifndef PROF_H
+#define PROF_H
+
+
+#include <stdlib.h>
+
+
+#include "types.h"
+#include "config.h"
+#include "cpu.h"
+#include "bytecode.h"
+#include "util.h"
+#include "terminate.h"
+#include "debug_data_loader.h"
+
+
+/**
+* True while the heap profiler is recording, the hooks below must only be called then
+**/
+extern bool g_prof_enabled;
+
+
+/**
+* Start the heap profiler if IJVM_HEAP_PROFILE names a file to write the report to.
+* Must be called once the program is loaded.
+* The report is written when the VM is destroyed and whenever the process receives SIGUSR1.
+**/
+void prof_init(const char* prog_path);
+
+
+/**
+* Called by every instruction that creates arrays with the PC of its op-code, before it fetches
+* its argument. The arrays created next are attributed to that instruction.
+**/
+void prof_site(const int32_t pc);
+
+
+/**
+* Called for every created array. Samples some of them and attributes them to the
+* allocating instruction (see prof_site) along with their size in bytes.
+**/
+void prof_alloc(const uint32_t arr_i, const size_t size);
+
+
+/**
+* Called once marking is done. Sampled arrays that are marked survived one more collection.
+**/
+void prof_collect(const bool* marked, const uint32_t num_marked);
+
+
+/**
+* Called for every removed array
+**/
+void prof_free(const uint32_t arr_i);
+
+
+/**
+* Write the report: allocation sites ranked by bytes and by number of arrays and a histogram
+* of the number of collections arrays survived (JSON)
+**/
+void prof_dump(void);
+
+
+/**
+* Write the report one last time then stop recording and free the profiler's memory
+**/
+void prof_destroy(void);
+
+
+#endif
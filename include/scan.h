@@ -0,0 +1,36 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+
+#include "types.h"
+#include "util.h"
+
+
+/**
+* Called with every word that matched the scanned for pattern
+**/
+typedef void (*ScanMatch_t)(const word_t word);
+
+
+/**
+* Select the fastest scan kernel supported by the host CPU.
+* Kernels are picked at runtime (AVX2, SSE2, or scalar) so a single binary runs everywhere.
+**/
+void scan_init(void);
+
+
+/**
+* Call 'on_match' for every word in 'words' for which (word & mask) == pattern.
+* Words are tested 8 at a time and only candidates are passed to the callback.
+**/
+void scan_words(const word_t* words, const uint32_t num, const uint32_t mask, const uint32_t pattern, ScanMatch_t on_match);
+
+
+/**
+* Call 'on_match' for every word in 'words' whose bit is set in the tag bitmap 'tags'
+* (bit n of tags[n / 32] belongs to words[n]). Set bits are found 32 at a time using ctz.
+**/
+void scan_tagged(const word_t* words, const uint32_t* tags, const uint32_t num, ScanMatch_t on_match);
+
+
+#endif
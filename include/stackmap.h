@@ -0,0 +1,53 @@
+#ifndef STACKMAP_H
+#define STACKMAP_H
+
+
+#include "types.h"
+#include "config.h"
+#include "cpu.h"
+#include "bytecode.h"
+#include "util.h"
+
+
+/**
+* Analyse the loaded program and build stack maps.
+* For every point where the garbage collector can run (NEWARRAY, GC, and the return address of
+* every INVOKEVIRTUAL) a stack map records which local variables and operand stack slots of the
+* frame may hold array references. Must be called once the CPU stack is initialized.
+**/
+void smap_build(void);
+
+
+/**
+* Gather the stack words that may hold array references.
+* Frames with a stack map only contribute slots that may hold references, frames without one
+* (or whose shape does not match the map) contribute all of their words. 'is_main' tells whether
+* the stack in the CPU is the main thread's, only its base frame has no frame link.
+* Return  number of root words, a pointer to which is stored in 'roots'
+**/
+uint32_t smap_roots(const word_t** roots, const bool is_main);
+
+
+/**
+* Return true if the analysis succeeded and the byte at 'pc' is only ever fetched as an op-code
+* (never as an argument or part of a method header). Always false inside a method whose own
+* analysis failed.
+**/
+bool smap_is_op(const int32_t pc);
+
+
+/**
+* Return true if the analysis succeeded and the instruction at 'pc' (NEWARRAY, NEWBYTEARRAY, or
+* MULTINEWARRAY) belongs to a method (other than main) whose arrays never outlive its frame.
+* Such a reference is never returned, stored in an array, passed to a method, or used in arithmetic.
+**/
+bool smap_is_frame_local(const int32_t pc);
+
+
+/**
+* Free all stack maps
+**/
+void smap_destroy(void);
+
+
+#endif
@@ -8,6 +8,11 @@
 #include "cpu.h"
 #include "array.h"
 #include "net.h"
+#include "stackmap.h"
+#include "prof.h"
+#include "io.h"
+#include "uring.h"
+#include "thread.h"
 
 
 /**
@@ -0,0 +1,95 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <unistd.h> // close
+#include <errno.h> // EINTR, ENOENT
+
+
+#include "types.h"
+#include "config.h"
+#include "cpu.h"
+#include "util.h"
+#include "terminate.h"
+#include "uring.h"
+
+
+/**
+* Green threads: every thread has its own stack and registers which are swapped into the CPU
+* while it runs. Threads only switch when the running one executes YIELD, waits in JOIN, ends, or
+* would wait for input (IN, INARRAY, NETIN, NETINARRAY, and NETACCEPT). Such an instruction parks
+* the thread until epoll reports its file descriptor ready (or an io_uring completion wakes it)
+* and is then executed again.
+**/
+extern bool g_threads; // A thread was spawned, instructions waiting for input park the running thread from now on
+
+
+/**
+* Create a thread running the method at 'method' with the arguments on top of the stack (which
+* are popped) and put it at the end of the run queue. The running thread goes on.
+* Return  thread reference
+**/
+word_t thread_spawn(const int32_t method);
+
+
+/**
+* Let the threads in the run queue run first (threads whose input became ready are woken up)
+**/
+void thread_yield(void);
+
+
+/**
+* Run other threads until 'fd' is ready for 'events' (epoll events), or until thread_wake is
+* called for it if 'events' is 0 (used for io_uring completions). The running thread continues
+* at its current PC once it runs again.
+* Return  false if the file descriptor can not be watched (the running thread goes on)
+**/
+bool thread_park(const int fd, const uint32_t events);
+
+
+/**
+* Put all threads parked on a file descriptor back into the run queue
+**/
+void thread_wake(const int fd);
+
+
+/**
+* Take the result of a thread if it ended, the thread reference is then no longer valid.
+* Otherwise run other threads until it ended, the running thread continues at its current PC
+* once it runs again. Only one thread may wait for a thread, a second one stops the machine.
+* Return  true if the thread had ended ('result' and 'tag' are set)
+**/
+bool thread_join(const word_t thread_ref, word_t* result, bool* tag);
+
+
+/**
+* Called by IRETURN once the frame at 'fp' was popped off. If it was the frame a thread was spawned
+* with the thread ends with the returned value as its result and the next thread runs.
+* Return  true if the thread ended
+**/
+bool thread_end(const int32_t fp, const word_t result, const bool tag);
+
+
+/**
+* Return  true if the main thread is running (also before any thread was spawned).
+*         Only the main thread has arrays local to its frames.
+**/
+bool thread_in_main(void);
+
+
+/**
+* Call 'visit' once for every thread that is not running with its stack and registers loaded
+* into the CPU (ended threads hold their result), then load the running thread again.
+* 'is_main' tells 'visit' whether the loaded thread is the main thread.
+**/
+void thread_visit(void (*visit)(const bool is_main));
+
+
+/**
+* Free all threads except the running one (its stack is freed with the CPU)
+**/
+void thread_destroy(void);
+
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef URING_H
+#define URING_H
+
+
+#include <linux/io_uring.h> // io_uring_sqe, io_uring_cqe, IORING_*
+#include <sys/syscall.h> // __NR_io_uring_*
+#include <sys/mman.h> // mmap
+#include <sys/uio.h> // iovec
+#include <signal.h> // _NSIG
+#include <errno.h> // EINTR, ETIME
+
+
+#include "types.h"
+#include "config.h"
+#include "cpu.h"
+#include "terminate.h"
+
+
+/**
+* Owners of requests. The top byte of the user data of a request holds its owner which handles
+* its completion, the next byte is free for the owner, and the low 48 bits usually hold a pointer.
+**/
+typedef enum EUringOwner { URING_IGNORE, URING_IO, URING_NET, URING_OWNERS }EUringOwner; // Completions of URING_IGNORE are dropped
+
+
+/**
+* Handles one completion of a request of its owner
+**/
+typedef void (*UringHandler_t)(const struct io_uring_cqe* cqe);
+
+
+/**
+* Return  user data of a request (see EUringOwner)
+**/
+static inline uint64_t uring_data(const EUringOwner owner, const uint8_t op, const void* ptr)
+{
+    return ((uint64_t)owner << 56) | ((uint64_t)op << 48) | (uint64_t)(uintptr_t)ptr;
+}
+
+
+/**
+* Return  pointer stored in the user data of a request
+**/
+static inline void* uring_data_ptr(const uint64_t data)
+{
+    return (void*)(uintptr_t)(data & 0xFFFFFFFFFFFFull);
+}
+
+
+/**
+* Return  the byte of the user data of a request that is free for its owner
+**/
+static inline uint8_t uring_data_op(const uint64_t data)
+{
+    return (uint8_t)(data >> 48);
+}
+
+
+/**
+* Set up the ring on the first call if IJVM_IO_URING is set and the kernel supports everything
+* needed (otherwise the classic system calls are used).
+* Return  true if the ring can be used
+**/
+bool uring_enabled(void);
+
+
+/**
+* Return  file descriptor of the ring (readable while completions are waiting to be handled)
+*         -1 if the ring is not set up
+**/
+int uring_fd(void);
+
+
+/**
+* Set the function handling completions of requests of an owner
+**/
+void uring_set_handler(const EUringOwner owner, const UringHandler_t handler);
+
+
+/**
+* Return  a cleared submission queue entry with the given user data. It is submitted with the
+*         next call to uring_submit or uring_wait (or earlier if the queue is full).
+**/
+struct io_uring_sqe* uring_sqe(const uint64_t data);
+
+
+/**
+* Submit all queued requests without waiting for any of them
+**/
+void uring_submit(void);
+
+
+/**
+* Submit all queued requests, wait up to 'timeout' milliseconds (forever if negative) for at
+* least one completion, then handle all completions.
+* Return  false if nothing completed in time
+**/
+bool uring_wait(const int32_t timeout);
+
+
+/**
+* Handle all completions that are there already (without a system call)
+**/
+void uring_reap(void);
+
+
+/**
+* Register buffers that read and write requests of the IO owner can use by index (fixed buffers).
+* Return  true on success
+**/
+bool uring_register_buffers(const struct iovec* iovs, const uint32_t num);
+
+
+/**
+* Give the kernel a ring of URING_RECV_BUFFERS buffers of URING_RECV_BUFFER_SIZE bytes which
+* receive requests with IOSQE_BUFFER_SELECT take their buffer from (group 0).
+* Return  true on success
+**/
+bool uring_provide_buffers(void);
+
+
+/**
+* Return  the provided buffer with the given id
+**/
+byte_t* uring_buffer(const uint16_t buf_id);
+
+
+/**
+* Give a provided buffer back to the kernel once its data was consumed
+**/
+void uring_recycle(const uint16_t buf_id);
+
+
+/**
+* Tear down the ring, every request must have completed
+**/
+void uring_destroy(void);
+
+
+#endif
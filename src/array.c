@@ -1,21 +1,112 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, madvise, pread
+
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+
+
 #include "array.h"
 
 
+/**
+* Header in front of the elements of every array
+**/
+typedef struct ArrHeader_t
+{
+    uint32_t count; // Number of elements
+    uint32_t kind; // Kind of elements, same as the lowest 4 bits of references to the array
+    uint32_t num_dims; // Number of dimensions, sizes of which are stored after the elements (and tags)
+    uint32_t mem; // Where the memory of the array comes from (one of k_mem_*)
+}ArrHeader_t;
+
+
+/**
+* An array allocated from the frame region, removed once its frame returns
+**/
+typedef struct ArrFrame_t
+{
+    uint32_t arr_i;
+    int32_t frame; // Frame pointer of the frame owning the array
+    uint32_t top; // Top of the frame region before the array was allocated
+}ArrFrame_t;
+
+
+/**
+* An array that was recently accessed
+**/
+typedef struct ArrCache_t
+{
+    word_t ref; // 0 if the entry is empty
+    uint32_t count; // Number of elements
+    ArrHeader_t* arr_ptr;
+}ArrCache_t;
+
+
 // Declarations of static functions
 static inline uint32_t ref_to_index(const word_t arr_ref);
-static inline word_t index_to_ref(const uint32_t arr_i);
-static word_t arr_store(const word_t* arr);
-static void arr_check_bounds(const word_t arr_ref, const word_t i);
+static inline word_t index_to_ref(const uint32_t arr_i, const uint32_t kind);
+static inline word_t* arr_words(const ArrHeader_t* arr_ptr);
+static inline byte_t* arr_bytes(const ArrHeader_t* arr_ptr);
+#ifdef GC_TAGS
+static inline uint32_t* arr_tags(const ArrHeader_t* arr_ptr);
+#endif
+static inline uint32_t* arr_dims(const ArrHeader_t* arr_ptr);
+static size_t arr_mem_size(const uint32_t count, const uint32_t kind, const uint32_t num_dims);
+static ArrHeader_t* arr_mem_alloc(const size_t size);
+static ArrHeader_t* arr_frame_alloc(const size_t size);
+static void arr_mem_free(ArrHeader_t* arr_ptr);
+static void zero_bytes(const ArrHeader_t* arr_ptr, byte_t* start, const size_t len);
+static uintptr_t page_size(void);
+static ArrHeader_t* arr_map_file(const int fd, const off_t pos, const uint32_t count);
+static word_t arr_read_file(const int fd, const off_t pos, const byte_t* head, const size_t head_len);
+static word_t arr_store(const ArrHeader_t* arr);
+static word_t arr_alloc(const word_t count, const uint32_t kind, const uint32_t num_dims, const word_t* sizes, const int32_t frame);
+static void arr_lookup(const word_t arr_ref, const uint32_t kind, ArrCache_t* entry);
+static inline const ArrCache_t* arr_cached(const word_t arr_ref, const uint32_t kind);
+static inline const ArrCache_t* arr_access(const word_t arr_ref, const word_t i, const uint32_t kind);
+static ArrHeader_t* arr_access_range(const word_t arr_ref, const int64_t from, const int64_t to);
+static void fill_words(const ArrHeader_t* arr_ptr, word_t* words, const uint32_t num, const word_t val);
+static void fill_bytes(const ArrHeader_t* arr_ptr, byte_t* bytes, const uint32_t num, const word_t val);
+static void widen_bytes(ArrHeader_t* arr_ptr, const word_t from, const byte_t* bytes, const uint32_t num);
 static void arr_remove(const uint32_t arr_i);
+static const word_t* arr_resolve(const word_t ref, uint32_t* arr_i, uint32_t* num_els, const uint32_t** tags);
+static void mark_ref(const word_t ref);
 static void mark_arrays(void);
-static uint32_t sweep_arrays(void);
+static void mark_stack(const bool is_main);
+static uint32_t sweep_arrays(const uint32_t max_slots, const uint32_t max_freed);
+static uint32_t start_gc(void);
 
 
-static const uint32_t k_index_to_ref = 0xAA00000A;
+static const uint32_t k_index_to_ref = 0xAA000000;
 static const uint32_t k_ref_to_index = 0x00FFFFF0;
+static const uint32_t k_kind_word = 0xA; // 0xAA?????A
+static const uint32_t k_kind_byte = 0xB; // 0xAA?????B
+static const uint32_t k_ref_mask = 0xFF00000E; // Matches references to arrays of both kinds
+static const uint32_t k_ref_pattern = 0xAA00000A;
+static const uint32_t k_mem_heap = 0; // calloc
+static const uint32_t k_mem_anon = 1; // Anonymous mapping
+static const uint32_t k_mem_file = 2; // Private mapping of a file placed right after a page holding the header
+static const uint32_t k_mem_frame = 3; // Frame region
 
-static MArr_t arr_mem = { 0, NULL, NULL }; // Keep track of arrays
+static MArr_t arr_mem = { 0, NULL, NULL, NULL, NULL, 0, NULL, 0 }; // Keep track of arrays
+static ArrCache_t arr_cache[ARRAYS_CACHE_NUM]; // Indexed by the lowest bits of the array index
+static uint32_t num_arrays = 0; // Number of existing arrays
 static bool* marked_arrays;
+static uint32_t num_marked_arrays = 0; // Size of marked_arrays (size of arr_mem when it was marked)
+static uint32_t* gray_arrays; // Marked arrays whose elements have not been scanned yet
+static uint32_t num_gray;
+static uint32_t* sweep_list = NULL; // Indices of the arrays that existed when marking started
+static uint32_t sweep_i = 0; // Next entry of sweep_list to be swept
+static uint32_t sweep_end = 0; // Entries from sweep_i up to here still have to be swept (0 if none)
+static uint32_t num_created = 0; // Arrays created on the heap since the last periodic collection
+
+static byte_t* frame_mem = NULL; // Frame region, arrays local to a frame are bump allocated from it
+static uint32_t frame_top = 0; // Bytes of the frame region in use
+static ArrFrame_t* frame_arrs = NULL; // Arrays in the frame region, oldest frame first
+static uint32_t num_frame_arrs = 0;
+static uint32_t size_frame_arrs = 0;
 
 
 /**
@@ -28,11 +119,317 @@ static inline uint32_t ref_to_index(const word_t arr_ref)
 
 
 /**
-* Create an array reference from array index
+* Create an array reference from array index and kind
+**/
+static inline word_t index_to_ref(const uint32_t i, const uint32_t kind)
+{
+    return (word_t)(k_index_to_ref | (i << 4) | kind);
+}
+
+
+/**
+* Elements of a word array
+**/
+static inline word_t* arr_words(const ArrHeader_t* arr_ptr)
+{
+    return (word_t*)(arr_ptr + 1);
+}
+
+
+/**
+* Elements of a byte array
+**/
+static inline byte_t* arr_bytes(const ArrHeader_t* arr_ptr)
+{
+    return (byte_t*)(arr_ptr + 1);
+}
+
+
+#ifdef GC_TAGS
+/**
+* Tags of the elements of a word array, stored right after the elements
+**/
+static inline uint32_t* arr_tags(const ArrHeader_t* arr_ptr)
+{
+    return (uint32_t*)&arr_words(arr_ptr)[arr_ptr->count];
+}
+#endif
+
+
+/**
+* Sizes of the dimensions of a word array, stored after the elements (and their tags)
+**/
+static inline uint32_t* arr_dims(const ArrHeader_t* arr_ptr)
+{
+#ifdef GC_TAGS
+    return &arr_tags(arr_ptr)[TAG_WORDS(arr_ptr->count)];
+#else
+    return (uint32_t*)&arr_words(arr_ptr)[arr_ptr->count];
+#endif
+}
+
+
+/**
+* Return the number of bytes taken by an array (header included)
+**/
+static size_t arr_mem_size(const uint32_t count, const uint32_t kind, const uint32_t num_dims)
+{
+    if (kind == k_kind_byte)
+    {
+        return sizeof(ArrHeader_t) + count;
+    }
+#ifdef GC_TAGS
+    return sizeof(ArrHeader_t) + ((size_t)count + TAG_WORDS(count) + num_dims) * sizeof(word_t); // Tags follow the elements
+#else
+    return sizeof(ArrHeader_t) + ((size_t)count + num_dims) * sizeof(word_t);
+#endif
+}
+
+
+/**
+* Get zeroed memory for an array.
+* Large arrays are mapped straight from the kernel so pages are only committed (and zeroed) once
+* they are touched, everything else comes from calloc.
+* Return  pointer to the memory or NULL on failure
+**/
+static ArrHeader_t* arr_mem_alloc(const size_t size)
+{
+    void* mem;
+
+    if (size < ARRAYS_MMAP_MIN_SIZE)
+    {
+        mem = calloc(1, size);
+        if (mem != NULL)
+        {
+            ((ArrHeader_t*)mem)->mem = k_mem_heap;
+        }
+        return (ArrHeader_t*)mem;
+    }
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(mem, size, MADV_HUGEPAGE); // Only a hint, fewer TLB misses when walking the array
+#endif
+    ((ArrHeader_t*)mem)->mem = k_mem_anon;
+    return (ArrHeader_t*)mem;
+}
+
+
+/**
+* Get zeroed memory for an array from the frame region.
+* The array still has to be recorded in frame_arrs (room for which is made here).
+* Return  pointer to the memory or NULL if the region is full
+**/
+static ArrHeader_t* arr_frame_alloc(const size_t size)
+{
+    const size_t aligned_size = (size + 15) & ~(size_t)15;
+    ArrFrame_t* tmp_arrs;
+    ArrHeader_t* arr_ptr;
+
+    if (aligned_size > ARRAYS_FRAME_REGION_SIZE - frame_top)
+    {
+        return NULL;
+    }
+    if (frame_mem == NULL)
+    {
+        frame_mem = (byte_t*)malloc(ARRAYS_FRAME_REGION_SIZE);
+        if (frame_mem == NULL)
+        {
+            return NULL;
+        }
+    }
+    if (num_frame_arrs == size_frame_arrs)
+    {
+        tmp_arrs = (ArrFrame_t*)realloc(frame_arrs, (size_frame_arrs * 2 + 64) * sizeof(ArrFrame_t));
+        if (tmp_arrs == NULL)
+        {
+            return NULL;
+        }
+        frame_arrs = tmp_arrs;
+        size_frame_arrs = size_frame_arrs * 2 + 64;
+    }
+
+    arr_ptr = (ArrHeader_t*)&frame_mem[frame_top];
+    memset(arr_ptr, 0, size);
+    arr_ptr->mem = k_mem_frame;
+    frame_top += (uint32_t)aligned_size;
+    return arr_ptr;
+}
+
+
+/**
+* Release memory of an array obtained from arr_mem_alloc or arr_map_file
+* (memory of arrays in the frame region is released by arr_release_frame)
+**/
+static void arr_mem_free(ArrHeader_t* arr_ptr)
+{
+    uintptr_t start;
+
+    if (arr_ptr->mem == k_mem_frame)
+    {
+        return;
+    }
+    if (arr_ptr->mem == k_mem_heap)
+    {
+        free(arr_ptr);
+    }
+    else if (arr_ptr->mem == k_mem_anon)
+    {
+        munmap(arr_ptr, arr_mem_size(arr_ptr->count, arr_ptr->kind, arr_ptr->num_dims));
+    }
+    else
+    {
+        start = ((uintptr_t)arr_bytes(arr_ptr) & ~(page_size() - 1)) - page_size(); // Page holding the header
+        munmap((void*)start, (uintptr_t)arr_bytes(arr_ptr) + arr_ptr->count - start);
+    }
+}
+
+
+/**
+* Zero 'len' bytes of an array starting at 'start'.
+* Whole pages of a mapped array are handed back to the kernel instead, they read as zero and no
+* longer take up memory until they are written again.
+**/
+static void zero_bytes(const ArrHeader_t* arr_ptr, byte_t* start, const size_t len)
+{
+    const uintptr_t first_page = ((uintptr_t)start + page_size() - 1) & ~(page_size() - 1);
+    const uintptr_t end_page = ((uintptr_t)start + len) & ~(page_size() - 1);
+
+    // Dropped pages of a file mapping would read as the file again, not as zero
+    if (arr_ptr->mem != k_mem_anon ||
+        end_page <= first_page ||
+        madvise((void*)first_page, end_page - first_page, MADV_DONTNEED) != 0)
+    {
+        memset(start, 0, len);
+        return;
+    }
+    memset(start, 0, first_page - (uintptr_t)start);
+    memset((void*)end_page, 0, (uintptr_t)start + len - end_page);
+}
+
+
+/**
+* Return the size of a memory page
+**/
+static uintptr_t page_size(void)
+{
+    static uintptr_t size = 0;
+    if (size == 0)
+    {
+        size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    }
+    return size;
+}
+
+
+/**
+* Map 'count' bytes of a file starting at 'pos' copy-on-write as the elements of a byte array.
+* A mapping of a file must start at a page boundary, so one anonymous page is reserved in front of
+* the file for the header and the elements start at the offset of 'pos' within its page.
+* 'pos' must be aligned for ArrHeader_t.
+* Return  pointer to the array or NULL if the file can not be mapped
+**/
+static ArrHeader_t* arr_map_file(const int fd, const off_t pos, const uint32_t count)
+{
+    const uintptr_t offset = (uintptr_t)pos & (page_size() - 1);
+    const size_t size = page_size() + offset + count;
+    byte_t* mem;
+    ArrHeader_t* arr_ptr;
+
+    mem = (byte_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (mmap(mem + page_size(), offset + count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+        pos - (off_t)offset) == MAP_FAILED)
+    {
+        munmap(mem, size);
+        return NULL;
+    }
+    madvise(mem + page_size(), offset + count, MADV_SEQUENTIAL); // Only a hint, read ahead aggressively
+
+    arr_ptr = (ArrHeader_t*)(mem + page_size() + offset) - 1;
+    arr_ptr->count = count;
+    arr_ptr->kind = k_kind_byte;
+    arr_ptr->num_dims = 1;
+    arr_ptr->mem = k_mem_file;
+    return arr_ptr;
+}
+
+
+/**
+* Read 'head' followed by everything left in a file that can not be mapped into a byte array.
+* Regular files are read from 'pos' on, anything else (a pipe or terminal, 'pos' is -1) from
+* wherever it currently is.
+* Return  array reference
+*         0 if nothing was left to read
 **/
-static inline word_t index_to_ref(const uint32_t i)
+static word_t arr_read_file(const int fd, const off_t pos, const byte_t* head, const size_t head_len)
 {
-    return (word_t)(k_index_to_ref | (i << 4));
+    byte_t* buf = NULL;
+    byte_t* tmp_buf;
+    size_t size = 0;
+    size_t len = 0;
+    ssize_t num_read;
+    word_t arr_ref;
+
+    for (;;)
+    {
+        if (size - len < BUFSIZ)
+        {
+            tmp_buf = (byte_t*)realloc(buf, size * 2 + head_len + BUFSIZ);
+            if (tmp_buf == NULL)
+            {
+                fprintf(stderr, "[ERR] Failed to allocate memory. In \"array.c::arr_read_file\".\n");
+                free(buf);
+                destroy_ijvm_now();
+            }
+            buf = tmp_buf;
+            size = size * 2 + head_len + BUFSIZ;
+            if (len == 0 && head_len != 0)
+            {
+                memcpy(buf, head, head_len);
+                len = head_len;
+            }
+        }
+        if (pos >= 0)
+        {
+            num_read = pread(fd, &buf[len], size - len, pos + (off_t)(len - head_len));
+        }
+        else
+        {
+            num_read = read(fd, &buf[len], size - len);
+        }
+        if (num_read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (num_read <= 0)
+        {
+            break;
+        }
+        len += (size_t)num_read;
+    }
+    if (len > INT32_MAX)
+    {
+        fprintf(stderr, "[ERR] Input is too large for an array. In \"array.c::arr_read_file\".\n");
+        free(buf);
+        destroy_ijvm_now();
+    }
+    if (len == 0)
+    {
+        free(buf);
+        return 0;
+    }
+
+    arr_ref = arr_create_bytes((word_t)len, -1);
+    memcpy(arr_bytes(arr_cached(arr_ref, k_kind_byte)->arr_ptr), buf, len);
+    free(buf);
+    return arr_ref;
 }
 
 
@@ -40,7 +437,7 @@ static inline word_t index_to_ref(const uint32_t i)
 * Add an array to array memory so it can be tracked/modified.
 * Return  array reference of saved array
 **/
-static word_t arr_store(const word_t* arr)
+static word_t arr_store(const ArrHeader_t* arr)
 {
     uint32_t arr_i;
     word_t arr_ref;
@@ -51,6 +448,19 @@ static word_t arr_store(const word_t* arr)
         marr_init(&arr_mem, ARRAYS_MIN_NUM);
     }
 
+    // Arrays local to a frame are removed when it returns, they do not call for a collection
+    if (arr->mem != k_mem_frame && ++num_created > GC_PERIOD)
+    {
+        num_created = 0;
+        arr_gc_lazy();
+    }
+
+    // Reclaim some arrays found dead by the last collection so their slots can be reused
+    if (sweep_end != 0)
+    {
+        sweep_arrays(GC_LAZY_SWEEP_SLOTS, 1);
+    }
+
     // Save array
     arr_i = marr_add_element(&arr_mem, (uintptr_t)arr);
     if (arr_i >= SIZE_MAX_UINT32_T)
@@ -58,10 +468,19 @@ static word_t arr_store(const word_t* arr)
         marr_resize(&arr_mem, arr_mem.size * 2);
         arr_i = marr_add_element(&arr_mem, (uintptr_t)arr);
     }
+    num_arrays++;
+    if (g_prof_enabled)
+    {
+        prof_alloc(arr_i, arr_mem_size(arr->count, arr->kind, arr->num_dims));
+    }
+    if (sweep_end != 0 && arr_i < num_marked_arrays)
+    {
+        marked_arrays[arr_i] = true; // Arrays created while sweeping is pending are alive
+    }
 
     // Return array reference
-    arr_ref = index_to_ref(arr_i);
-    if ((((uint32_t)arr_ref & 0xFF00000F) ^ k_index_to_ref) != 0)
+    arr_ref = index_to_ref(arr_i, arr->kind);
+    if ((((uint32_t)arr_ref & 0xFF00000F) ^ (k_index_to_ref | arr->kind)) != 0)
     {
         fprintf(stderr, "[ERR] Program requires more arrays than is supported. In \"array.c::arr_store\".\n");
         destroy_ijvm_now();
@@ -70,222 +489,773 @@ static word_t arr_store(const word_t* arr)
 }
 
 
-word_t arr_create(const word_t count)
+/**
+* Allocate a zeroed array of the given kind and start tracking it.
+* Word arrays with more than one dimension also store the size of every dimension.
+* Arrays local to a frame (if 'frame' is not -1) come from the frame region while it has room.
+* Return  array reference
+**/
+static word_t arr_alloc(const word_t count, const uint32_t kind, const uint32_t num_dims, const word_t* sizes, const int32_t frame)
 {
+    size_t size;
+    ArrHeader_t* arr_ptr = NULL;
     word_t arr_ref;
-    word_t* arr_ptr;
-    uint32_t tmp_count;
+
     if (count <= 0)
     {
-        fprintf(stderr, "[ERR] Invalid array size. In \"array.c::arr_create\".\n");
+        fprintf(stderr, "[ERR] Invalid array size. In \"array.c::arr_alloc\".\n");
         destroy_ijvm_now();
     }
 
-    tmp_count = (uint32_t)count;
-    arr_ptr = (word_t*)calloc(tmp_count + 1, sizeof(word_t));
+    size = arr_mem_size((uint32_t)count, kind, num_dims);
+    if (frame != -1)
+    {
+        arr_ptr = arr_frame_alloc(size);
+    }
+    if (arr_ptr == NULL)
+    {
+        arr_ptr = arr_mem_alloc(size);
+    }
     if (arr_ptr == NULL)
     {
         if (arr_gc() != 0)
         {
-            return arr_create(count); // Run GC to be sure memory allocation error is not caused by garbage
+            return arr_alloc(count, kind, num_dims, sizes, frame); // Run GC to be sure memory allocation error is not caused by garbage
         }
-        fprintf(stderr, "[ERR] Failed to allocate memory. In \"array.c::arr_create\".\n");
+        fprintf(stderr, "[ERR] Failed to allocate memory. In \"array.c::arr_alloc\".\n");
         destroy_ijvm_now();
     }
-    
-    arr_ptr[0] = count; // First element stores array's size in 'elements' units
+
+    arr_ptr->count = (uint32_t)count;
+    arr_ptr->kind = kind;
+    arr_ptr->num_dims = num_dims;
+    for (uint32_t dim_i = 0; dim_i < num_dims && kind == k_kind_word; dim_i++)
+    {
+        arr_dims(arr_ptr)[dim_i] = (uint32_t)sizes[dim_i];
+    }
     arr_ref = arr_store(arr_ptr);
+
+    if (arr_ptr->mem == k_mem_frame)
+    {
+        frame_arrs[num_frame_arrs].arr_i = ref_to_index(arr_ref);
+        frame_arrs[num_frame_arrs].frame = frame;
+        frame_arrs[num_frame_arrs].top = (uint32_t)((byte_t*)arr_ptr - frame_mem);
+        num_frame_arrs++;
+    }
     return arr_ref;
 }
 
 
+word_t arr_create(const word_t count, const int32_t frame)
+{
+    return arr_alloc(count, k_kind_word, 1, &count, frame);
+}
+
+
+word_t arr_create_bytes(const word_t count, const int32_t frame)
+{
+    return arr_alloc(count, k_kind_byte, 1, &count, frame);
+}
+
+
+word_t arr_create_file(const int fd, const off_t pos, const byte_t* head, const size_t head_len)
+{
+    struct stat st;
+    ArrHeader_t* arr_ptr = NULL;
+
+    // The header right in front of the elements must be aligned, so must the read position
+    if (head_len != 0 || pos < 0 || pos % _Alignof(ArrHeader_t) != 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return arr_read_file(fd, pos, head, head_len);
+    }
+    if (st.st_size <= pos)
+    {
+        return 0;
+    }
+    if (st.st_size - pos > INT32_MAX)
+    {
+        fprintf(stderr, "[ERR] Input is too large for an array. In \"array.c::arr_create_file\".\n");
+        destroy_ijvm_now();
+    }
+
+    arr_ptr = arr_map_file(fd, pos, (uint32_t)(st.st_size - pos));
+    if (arr_ptr == NULL)
+    {
+        return arr_read_file(fd, pos, head, head_len);
+    }
+    return arr_store(arr_ptr);
+}
+
+
+word_t arr_create_multi(const uint32_t num_dims, const word_t* sizes, const int32_t frame)
+{
+    int64_t count = 1;
+
+    if (num_dims == 0 || num_dims > ARRAYS_MAX_DIMS)
+    {
+        fprintf(stderr, "[ERR] Invalid number of array dimensions. In \"array.c::arr_create_multi\".\n");
+        destroy_ijvm_now();
+    }
+    for (uint32_t dim_i = 0; dim_i < num_dims; dim_i++)
+    {
+        count *= sizes[dim_i];
+        if (sizes[dim_i] <= 0 || count > INT32_MAX)
+        {
+            fprintf(stderr, "[ERR] Invalid array size. In \"array.c::arr_create_multi\".\n");
+            destroy_ijvm_now();
+        }
+    }
+    return arr_alloc((word_t)count, k_kind_word, num_dims, sizes, frame);
+}
+
+
 /**
-* Utility to check if combintation of array reference and index are valid
+* Find the array behind a reference and store it in a cache entry.
+* Errors out if the reference is malformed, does not reference an array of the given kind,
+* or the array does not exist.
 **/
-static void arr_check_bounds(const word_t arr_ref, const word_t i)
+static void arr_lookup(const word_t arr_ref, const uint32_t kind, ArrCache_t* entry)
 {
-    uint32_t arr_size;
     uint32_t arr_i;
-    word_t* arr_ptr;
+    ArrHeader_t* arr_ptr;
 
     arr_i = ref_to_index(arr_ref);
-    if ((((uint32_t)arr_ref & 0xFF00000F) ^ k_index_to_ref) != 0)
+    if ((((uint32_t)arr_ref & 0xFF00000F) ^ (k_index_to_ref | kind)) != 0)
     {
-        fprintf(stderr, "[ERR] Invalid array reference. In \"array.c::arr_check_bounds\".\n");
+        fprintf(stderr, "[ERR] Invalid array reference. In \"array.c::arr_lookup\".\n");
         destroy_ijvm_now();
     }
 
-    arr_ptr = (word_t*)marr_get_element(&arr_mem, arr_i);
-    if (arr_ptr == NULL)
+    arr_ptr = (ArrHeader_t*)marr_get_element(&arr_mem, arr_i);
+    // Arrays the last collection found dead are only removed lazily, they must not be used meanwhile
+    if (arr_ptr == NULL || (sweep_end != 0 && arr_i < num_marked_arrays && marked_arrays[arr_i] == false))
+    {
+        fprintf(stderr, "[ERR] Program tried to access a non-existent array. In \"array.c::arr_lookup\".\n");
+        destroy_ijvm_now();
+    }
+    if (arr_ptr->kind != kind)
     {
-        fprintf(stderr, "[ERR] Program tried to access a non-existent array. In \"array.c::arr_check_bounds\".\n");
+        fprintf(stderr, "[ERR] Invalid array reference. In \"array.c::arr_lookup\".\n");
         destroy_ijvm_now();
     }
 
-    arr_size = (uint32_t)arr_ptr[0];
-    if (i + 1 < 1 || (uint32_t)(i + 1) > arr_size)
+    entry->ref = arr_ref;
+    entry->count = arr_ptr->count;
+    entry->arr_ptr = arr_ptr;
+}
+
+
+/**
+* Resolve the array of a given kind behind a reference through the cache.
+* Repeated accesses to a cached array cost one compare of the reference (and its kind).
+* Return  cache entry of the array (only valid until another array is resolved)
+**/
+static inline const ArrCache_t* arr_cached(const word_t arr_ref, const uint32_t kind)
+{
+    ArrCache_t* entry = &arr_cache[ref_to_index(arr_ref) & (ARRAYS_CACHE_NUM - 1)];
+
+    if (entry->ref != arr_ref || ((uint32_t)arr_ref & 0xF) != kind)
     {
-        fprintf(stderr, "[ERR] Program tried to access a memory outside of an array. In \"array.c::arr_check_bounds\".\n");
+        arr_lookup(arr_ref, kind, entry);
+    }
+    return entry;
+}
+
+
+/**
+* Resolve the array behind a reference and check that 'i' is a valid index.
+* Return  cache entry of the array
+**/
+static inline const ArrCache_t* arr_access(const word_t arr_ref, const word_t i, const uint32_t kind)
+{
+    const ArrCache_t* entry = arr_cached(arr_ref, kind);
+
+    if ((uint32_t)i >= entry->count)
+    {
+        fprintf(stderr, "[ERR] Program tried to access a memory outside of an array. In \"array.c::arr_access\".\n");
         destroy_ijvm_now();
     }
+    return entry;
 }
 
 
 word_t arr_get(const word_t arr_ref, const word_t i)
 {
-    uint32_t arr_i;
-    word_t* arr_ptr;
-
-    arr_i = ref_to_index(arr_ref);
-    arr_check_bounds(arr_ref, i);
-    arr_ptr = (word_t*)marr_get_element(&arr_mem, arr_i);
-    return arr_ptr[i + 1]; // First element is at index 1 (0'th element stores array size)
+    return arr_words(arr_access(arr_ref, i, k_kind_word)->arr_ptr)[i];
 }
 
 
 void arr_set(const word_t arr_ref, const word_t i, const word_t val)
 {
-    uint32_t arr_i;
-    word_t* arr_ptr;
+    const ArrCache_t* entry = arr_access(arr_ref, i, k_kind_word);
+    arr_words(entry->arr_ptr)[i] = val;
+#ifdef GC_TAGS
+    tag_set(arr_tags(entry->arr_ptr), (uint32_t)i, false);
+#endif
+}
 
-    arr_i = ref_to_index(arr_ref);
-    arr_check_bounds(arr_ref, i);
-    arr_ptr = (word_t*)marr_get_element(&arr_mem, arr_i);
-    arr_ptr[i + 1] = val; // First element is at index 1 (0'th element stores array size)
+
+word_t arr_multi_index(const word_t arr_ref, const uint32_t num_dims, const word_t* indices)
+{
+    const ArrHeader_t* arr_ptr = arr_cached(arr_ref, k_kind_word)->arr_ptr;
+    const uint32_t* sizes = arr_dims(arr_ptr);
+    uint32_t flat_i = 0;
+
+    if (num_dims != arr_ptr->num_dims)
+    {
+        fprintf(stderr, "[ERR] Wrong number of indices for array. In \"array.c::arr_multi_index\".\n");
+        destroy_ijvm_now();
+    }
+    for (uint32_t dim_i = 0; dim_i < num_dims; dim_i++)
+    {
+        if ((uint32_t)indices[dim_i] >= sizes[dim_i])
+        {
+            fprintf(stderr, "[ERR] Program tried to access a memory outside of an array. In \"array.c::arr_multi_index\".\n");
+            destroy_ijvm_now();
+        }
+        flat_i = flat_i * sizes[dim_i] + (uint32_t)indices[dim_i]; // Row-major
+    }
+    return (word_t)flat_i;
+}
+
+
+word_t arr_get_byte(const word_t arr_ref, const word_t i)
+{
+    return arr_bytes(arr_access(arr_ref, i, k_kind_byte)->arr_ptr)[i];
+}
+
+
+void arr_set_byte(const word_t arr_ref, const word_t i, const word_t val)
+{
+    arr_bytes(arr_access(arr_ref, i, k_kind_byte)->arr_ptr)[i] = (byte_t)val;
+}
+
+
+/**
+* Resolve the array (of any kind) behind a reference and check that elements from 'from' up to
+* (excluding) 'to' are inside of the array.
+* Return  pointer to the array
+**/
+static ArrHeader_t* arr_access_range(const word_t arr_ref, const int64_t from, const int64_t to)
+{
+    const uint32_t kind = ((uint32_t)arr_ref & 0xF) == k_kind_byte ? k_kind_byte : k_kind_word;
+    const ArrCache_t* entry = arr_cached(arr_ref, kind);
+
+    if (from < 0 || to < from || to > entry->count)
+    {
+        fprintf(stderr, "[ERR] Program tried to access a memory outside of an array. In \"array.c::arr_access_range\".\n");
+        destroy_ijvm_now();
+    }
+    return entry->arr_ptr;
+}
+
+
+void arr_copy(const word_t src_ref, const word_t src_pos, const word_t dst_ref, const word_t dst_pos, const word_t len)
+{
+    // Both arrays can map to the same cache entry so keep the pointers, not the entries
+    ArrHeader_t* src_ptr = arr_access_range(src_ref, src_pos, (int64_t)src_pos + len);
+    ArrHeader_t* dst_ptr = arr_access_range(dst_ref, dst_pos, (int64_t)dst_pos + len);
+
+    if (src_ptr->kind != dst_ptr->kind)
+    {
+        fprintf(stderr, "[ERR] Can not copy between arrays of different kinds. In \"array.c::arr_copy\".\n");
+        destroy_ijvm_now();
+    }
+    if (src_ptr->kind == k_kind_byte)
+    {
+        memmove(&arr_bytes(dst_ptr)[dst_pos], &arr_bytes(src_ptr)[src_pos], (uint32_t)len);
+        return;
+    }
+
+    memmove(&arr_words(dst_ptr)[dst_pos], &arr_words(src_ptr)[src_pos], (uint32_t)len * sizeof(word_t)); // Arrays may overlap (same array)
+#ifdef GC_TAGS
+    const uint32_t* src_tags = arr_tags(src_ptr);
+    uint32_t* dst_tags = arr_tags(dst_ptr);
+    if (dst_ptr != src_ptr || dst_pos <= src_pos)
+    {
+        for (uint32_t i = 0; i < (uint32_t)len; i++)
+        {
+            tag_set(dst_tags, (uint32_t)dst_pos + i, tag_get(src_tags, (uint32_t)src_pos + i));
+        }
+    }
+    else
+    {
+        for (uint32_t i = (uint32_t)len; i > 0; i--)
+        {
+            tag_set(dst_tags, (uint32_t)dst_pos + i - 1, tag_get(src_tags, (uint32_t)src_pos + i - 1));
+        }
+    }
+#endif
+}
+
+
+/**
+* Set 'num' words starting at 'words' to 'val'.
+* The filled part is doubled with every memcpy so the bulk of the work is done by the (vectorised)
+* library copy instead of one store per element.
+**/
+static void fill_words(const ArrHeader_t* arr_ptr, word_t* words, const uint32_t num, const word_t val)
+{
+    uint32_t num_filled;
+
+    if (num == 0)
+    {
+        return;
+    }
+    if (val == 0)
+    {
+        zero_bytes(arr_ptr, (byte_t*)words, num * sizeof(word_t));
+        return;
+    }
+    words[0] = val;
+    for (num_filled = 1; num_filled * 2 <= num; num_filled *= 2)
+    {
+        memcpy(&words[num_filled], words, num_filled * sizeof(word_t));
+    }
+    memcpy(&words[num_filled], words, (num - num_filled) * sizeof(word_t));
+}
+
+
+
+/**
+* Set 'num' bytes starting at 'bytes' to the lowest 8 bits of 'val'
+**/
+static void fill_bytes(const ArrHeader_t* arr_ptr, byte_t* bytes, const uint32_t num, const word_t val)
+{
+    if ((byte_t)val == 0)
+    {
+        zero_bytes(arr_ptr, bytes, num);
+    }
+    else
+    {
+        memset(bytes, (byte_t)val, num);
+    }
+}
+
+
+void arr_fill(const word_t arr_ref, const word_t from, const word_t to, const word_t val)
+{
+    ArrHeader_t* arr_ptr = arr_access_range(arr_ref, from, to);
+
+    if (arr_ptr->kind == k_kind_byte)
+    {
+        fill_bytes(arr_ptr, &arr_bytes(arr_ptr)[from], (uint32_t)(to - from), val);
+        return;
+    }
+    fill_words(arr_ptr, &arr_words(arr_ptr)[from], (uint32_t)(to - from), val);
+#ifdef GC_TAGS
+    for (uint32_t i = (uint32_t)from; i < (uint32_t)to; i++)
+    {
+        tag_set(arr_tags(arr_ptr), i, false);
+    }
+#endif
 }
 
 
+/**
+* Store 'num' bytes in the elements of a word array starting at 'from', one byte per element
+**/
+static void widen_bytes(ArrHeader_t* arr_ptr, const word_t from, const byte_t* bytes, const uint32_t num)
+{
+    word_t* words = &arr_words(arr_ptr)[from];
+
+    for (uint32_t i = 0; i < num; i++)
+    {
+        words[i] = bytes[i];
+#ifdef GC_TAGS
+        tag_set(arr_tags(arr_ptr), (uint32_t)from + i, false);
+#endif
+    }
+}
+
+
+word_t arr_input(const word_t arr_ref, const word_t from, const word_t len)
+{
+    ArrHeader_t* arr_ptr = arr_access_range(arr_ref, from, (int64_t)from + len);
+    byte_t chunk[BUFSIZ];
+    uint32_t num_read;
+
+    if (arr_ptr->kind == k_kind_byte)
+    {
+        return (word_t)io_read(&arr_bytes(arr_ptr)[from], (uint32_t)len);
+    }
+
+    // A second read could wait for input, so a word array gets at most one chunk at a time
+    num_read = io_read(chunk, (uint32_t)len < BUFSIZ ? (uint32_t)len : BUFSIZ);
+    widen_bytes(arr_ptr, from, chunk, num_read);
+    return (word_t)num_read;
+}
+
+
+void arr_output(const word_t arr_ref, const word_t from, const word_t len)
+{
+    const ArrHeader_t* arr_ptr = arr_access_range(arr_ref, from, (int64_t)from + len);
+    const word_t* words;
+    byte_t chunk[BUFSIZ];
+    uint32_t num;
+
+    if (arr_ptr->kind == k_kind_byte)
+    {
+        io_write(&arr_bytes(arr_ptr)[from], (uint32_t)len);
+        return;
+    }
+
+    // Only the lowest 8 bits of every element are written, same as OUT
+    words = &arr_words(arr_ptr)[from];
+    for (uint32_t done = 0; done < (uint32_t)len; done += num)
+    {
+        num = (uint32_t)len - done < BUFSIZ ? (uint32_t)len - done : BUFSIZ;
+        for (uint32_t i = 0; i < num; i++)
+        {
+            chunk[i] = (byte_t)words[done + i];
+        }
+        io_write(chunk, num);
+    }
+}
+
+
+
+word_t arr_net_input(const word_t arr_ref, const word_t from, const word_t len, const word_t net_ref)
+{
+    ArrHeader_t* arr_ptr = arr_access_range(arr_ref, from, (int64_t)from + len);
+    byte_t chunk[BUFSIZ];
+    word_t num_recvd;
+
+    if (arr_ptr->kind == k_kind_byte)
+    {
+        return net_recv_bytes(net_ref, &arr_bytes(arr_ptr)[from], (uint32_t)len);
+    }
+
+    // Through a buffer like in arr_input, a second receive could wait as well
+    num_recvd = net_recv_bytes(net_ref, chunk, (uint32_t)len < BUFSIZ ? (uint32_t)len : BUFSIZ);
+    if (num_recvd > 0)
+    {
+        widen_bytes(arr_ptr, from, chunk, (uint32_t)num_recvd);
+    }
+    return num_recvd;
+}
+
+
+word_t arr_net_output(const word_t arr_ref, const word_t from, const word_t len, const word_t net_ref)
+{
+    const ArrHeader_t* arr_ptr = arr_access_range(arr_ref, from, (int64_t)from + len);
+    const word_t* words;
+    byte_t chunk[BUFSIZ];
+    uint32_t num;
+    word_t num_sent;
+    word_t done;
+
+    if (arr_ptr->kind == k_kind_byte)
+    {
+        return net_send_bytes(net_ref, &arr_bytes(arr_ptr)[from], (uint32_t)len);
+    }
+
+    // Only the lowest 8 bits of every element are sent, same as arr_output
+    words = &arr_words(arr_ptr)[from];
+    for (done = 0; done < len; done += num_sent)
+    {
+        num = (uint32_t)(len - done) < BUFSIZ ? (uint32_t)(len - done) : BUFSIZ;
+        for (uint32_t i = 0; i < num; i++)
+        {
+            chunk[i] = (byte_t)words[done + i];
+        }
+        num_sent = net_send_bytes(net_ref, chunk, num);
+        if (num_sent < (word_t)num)
+        {
+            return done + num_sent; // The connection failed
+        }
+    }
+    return done;
+}
+
+
+#ifdef GC_TAGS
+void arr_fill_tagged(const word_t arr_ref, const word_t from, const word_t to, const word_t val, const bool tag)
+{
+    ArrHeader_t* arr_ptr = arr_access_range(arr_ref, from, to);
+
+    if (arr_ptr->kind == k_kind_byte)
+    {
+        fill_bytes(arr_ptr, &arr_bytes(arr_ptr)[from], (uint32_t)(to - from), val); // Bytes are never references
+        return;
+    }
+    fill_words(arr_ptr, &arr_words(arr_ptr)[from], (uint32_t)(to - from), val);
+    for (uint32_t i = (uint32_t)from; i < (uint32_t)to; i++)
+    {
+        tag_set(arr_tags(arr_ptr), i, tag);
+    }
+}
+
+
+word_t arr_get_tagged(const word_t arr_ref, const word_t i, bool* tag)
+{
+    const ArrCache_t* entry = arr_access(arr_ref, i, k_kind_word);
+    *tag = tag_get(arr_tags(entry->arr_ptr), (uint32_t)i);
+    return arr_words(entry->arr_ptr)[i];
+}
+
+
+void arr_set_tagged(const word_t arr_ref, const word_t i, const word_t val, const bool tag)
+{
+    const ArrCache_t* entry = arr_access(arr_ref, i, k_kind_word);
+    arr_words(entry->arr_ptr)[i] = val;
+    tag_set(arr_tags(entry->arr_ptr), (uint32_t)i, tag);
+}
+#endif
+
+
 /**
 * Remove a single array based on index in array memory
 **/
 static void arr_remove(const uint32_t arr_i)
 {
-    free((word_t*)marr_get_element(&arr_mem, arr_i));
+    ArrCache_t* entry = &arr_cache[arr_i & (ARRAYS_CACHE_NUM - 1)];
+    if (entry->ref != 0 && ref_to_index(entry->ref) == arr_i)
+    {
+        entry->ref = 0;
+    }
+    if (g_prof_enabled)
+    {
+        prof_free(arr_i);
+    }
+    arr_mem_free((ArrHeader_t*)marr_get_element(&arr_mem, arr_i));
     marr_remove_element(&arr_mem, arr_i);
+    num_arrays--;
+}
+
+
+void arr_release_frame(const int32_t frame)
+{
+    while (num_frame_arrs > 0 && frame_arrs[num_frame_arrs - 1].frame >= frame)
+    {
+        num_frame_arrs--;
+        arr_remove(frame_arrs[num_frame_arrs].arr_i);
+        frame_top = frame_arrs[num_frame_arrs].top;
+    }
 }
 
 
 void arr_destroy(void)
 {
-    for (uint32_t arr_i = 0; arr_i < arr_mem.size; arr_i++)
+    while (arr_mem.num_live > 0)
     {
-        if (marr_check_marked(&arr_mem, arr_i) == true)
-        {
-            arr_remove(arr_i);
-        }
+        arr_remove(arr_mem.live[arr_mem.num_live - 1]);
     }
     marr_destroy(&arr_mem);
+    free(frame_mem);
+    free(frame_arrs);
+    frame_mem = NULL;
+    frame_arrs = NULL;
+    frame_top = 0;
+    num_frame_arrs = 0;
+    size_frame_arrs = 0;
+    num_created = 0;
     free(marked_arrays);
+    free(gray_arrays);
+    free(sweep_list);
+    marked_arrays = NULL;
+    gray_arrays = NULL;
+    sweep_list = NULL;
+    num_marked_arrays = 0;
+    sweep_i = 0;
+    sweep_end = 0;
+    gcpar_destroy();
 }
 
 
 /**
-* Mark all inaccessible arrays and return the number of marked arrays
+* Return elements of the array behind a reference (or NULL if no such array exists).
+* Byte arrays never hold references so they have no elements to scan.
+* Only reads array memory so it is safe to call from GC worker threads.
 **/
-static void mark_arrays(void)
+static const word_t* arr_resolve(const word_t ref, uint32_t* arr_i, uint32_t* num_els, const uint32_t** tags)
 {
-    word_t stack_el;
+    const uint32_t i = ref_to_index(ref);
+    const ArrHeader_t* arr_ptr;
 
+    if (i >= arr_mem.size || arr_mem.map[i] == false)
+    {
+        return NULL;
+    }
+    arr_ptr = (const ArrHeader_t*)arr_mem.values[i];
+    *arr_i = i;
+    *num_els = arr_ptr->kind == k_kind_word ? arr_ptr->count : 0;
+#ifdef GC_TAGS
+    *tags = arr_ptr->kind == k_kind_word ? arr_tags(arr_ptr) : NULL;
+#else
+    *tags = NULL;
+#endif
+    return arr_words(arr_ptr);
+}
+
+
+/**
+* Mark the array behind a word found by the scan kernel and queue it for scanning
+**/
+static void mark_ref(const word_t ref)
+{
     uint32_t arr_i;
-    word_t* arr_ptr;
-    uint32_t arr_size;
+    uint32_t num_els;
+    const uint32_t* tags;
+
+    if (arr_resolve(ref, &arr_i, &num_els, &tags) != NULL && marked_arrays[arr_i] == false)
+    {
+        marked_arrays[arr_i] = true;
+        gray_arrays[num_gray++] = arr_i; // Every array is queued at most once
+    }
+}
 
-    word_t arr_el;
-    uint32_t arr_el_arr_i;
 
-    // Look for array references on the stack
-    for (int stack_i = 0; stack_i < g_cpu->sp; stack_i++)
+/**
+* Mark all accessible arrays, the stacks of all threads are roots
+**/
+static void mark_arrays(void)
+{
+    mark_stack(thread_in_main());
+    thread_visit(mark_stack);
+}
+
+
+/**
+* Mark all arrays accessible from the stack in the CPU ('is_main' if it is the main thread's)
+**/
+static void mark_stack(const bool is_main)
+{
+    const word_t* els;
+    uint32_t arr_i;
+    uint32_t num_els;
+    const uint32_t* tags;
+#ifdef GC_TAGS
+    const word_t* roots = g_cpu->stack;
+    const uint32_t* root_tags = g_cpu->stack_tags; // Only tagged words are references
+    const uint32_t num_roots = (uint32_t)(g_cpu->sp + 1);
+    (void)is_main;
+#else
+    const word_t* roots;
+    const uint32_t* root_tags = NULL;
+    const uint32_t num_roots = smap_roots(&roots, is_main); // Stack words that may hold references
+#endif
+
+    if (num_arrays >= GC_PARALLEL_MIN_ARRAYS && gcpar_num_workers() > 1)
     {
-        stack_el = g_cpu->stack[stack_i];
-        if ((((uint32_t)stack_el & 0xFF00000F) ^ k_index_to_ref) != 0)
-        {
-            continue; // Element is not in array reference format
-        }
+        gcpar_mark(roots, root_tags, num_roots, marked_arrays, k_ref_mask, k_ref_pattern, arr_resolve);
+        return;
+    }
 
-        arr_i = ref_to_index(stack_el);
-        if (marr_check_marked(&arr_mem, arr_i) == true)
-        {
-            marked_arrays[arr_i] = true;
-            continue;
-        }
+    // Look for array references among the roots
+    num_gray = 0;
+    if (root_tags != NULL)
+    {
+        scan_tagged(roots, root_tags, num_roots, mark_ref);
+    }
+    else
+    {
+        scan_words(roots, num_roots, k_ref_mask, k_ref_pattern, mark_ref);
     }
 
-    // Check if array elements hold array references
-    for (uint32_t marked_i = 0; marked_i < arr_mem.size; marked_i++)
+    // Check if elements of marked arrays hold array references until no new arrays get marked
+    while (num_gray > 0)
     {
-        if (marked_arrays[marked_i] == false)
+        els = arr_resolve(index_to_ref(gray_arrays[--num_gray], k_kind_word), &arr_i, &num_els, &tags);
+        if (tags != NULL)
         {
-            /**
-            * Array reference needs to exist on the stack
-            * for its elements to have an effect on what will not
-            * be counted as garbage.
-            **/
-            continue; 
+            scan_tagged(els, tags, num_els, mark_ref);
         }
-
-        arr_i = marked_i;
-        arr_ptr = (word_t*)marr_get_element(&arr_mem, arr_i);
-        arr_size = (uint32_t)arr_ptr[0];
-        for (word_t el_i = 1; (uint32_t)el_i <= arr_size; el_i++)
+        else
         {
-            arr_el = arr_ptr[el_i];
-            if ((((uint32_t)arr_el & 0xFF00000F) ^ k_index_to_ref) != 0)
-            {
-                continue; // Element is not in array reference format
-            }
-
-            arr_el_arr_i = ref_to_index(arr_el);
-            if (arr_el_arr_i == arr_i)
-            {
-                continue; // Array stores reference to itself
-            }
-            if (marr_check_marked(&arr_mem, arr_el_arr_i) == true)
-            {
-                marked_arrays[arr_el_arr_i] = true;
-                continue;
-            }
+            scan_words(els, num_els, k_ref_mask, k_ref_pattern, mark_ref);
         }
     }
 }
 
 
 /**
-* Sweep all inaccessible arrays and return the number of arrays that were removed
+* Sweep pending (unmarked) arrays starting at entry sweep_i of the sweep list. Stop after
+* examining 'max_slots' entries or removing 'max_freed' arrays, whichever comes first.
+* Once the whole list is swept the array memory is shrunk if it became mostly empty.
+* Return the number of arrays that were removed
 **/
-static uint32_t sweep_arrays(void)
+static uint32_t sweep_arrays(const uint32_t max_slots, const uint32_t max_freed)
 {
     uint32_t num_swept = 0;
-    for (uint32_t i = 0; i < arr_mem.size; i++)
+    uint32_t arr_i;
+
+    for (uint32_t num_slots = 0; sweep_i < sweep_end && num_slots < max_slots && num_swept < max_freed; num_slots++, sweep_i++)
     {
-        if (marked_arrays[i] != true && marr_check_marked(&arr_mem, i) == true)
+        arr_i = sweep_list[sweep_i];
+        if (marked_arrays[arr_i] != true && marr_check_marked(&arr_mem, arr_i) == true &&
+            ((const ArrHeader_t*)arr_mem.values[arr_i])->mem != k_mem_frame) // Removed when their frame returns
         {
-            arr_remove(i);
+            arr_remove(arr_i);
             num_swept++;
         }
     }
+    if (sweep_i >= sweep_end)
+    {
+        sweep_i = 0;
+        sweep_end = 0;
+        if (arr_mem.size != 0)
+        {
+            marr_shrink(&arr_mem, ARRAYS_MIN_NUM);
+        }
+    }
     return num_swept;
 }
 
 
-uint32_t arr_gc(void)
+/**
+* Finish sweeping left over from the previous collection then mark all accessible arrays.
+* Every existing array is left pending to be swept.
+* Return the number of arrays removed while finishing the previous sweep
+**/
+static uint32_t start_gc(void)
 {
-    uint32_t num_freed;
+    const uint32_t num_freed = sweep_arrays(SIZE_MAX_UINT32_T, SIZE_MAX_UINT32_T);
 
     free(marked_arrays);
+    free(gray_arrays);
+    free(sweep_list);
     marked_arrays = (bool*)calloc(arr_mem.size, sizeof(bool));
-    if (marked_arrays == NULL)
+    gray_arrays = (uint32_t*)malloc(arr_mem.size * sizeof(uint32_t));
+    sweep_list = (uint32_t*)malloc(arr_mem.num_live * sizeof(uint32_t));
+    if (marked_arrays == NULL || gray_arrays == NULL || (sweep_list == NULL && arr_mem.num_live != 0))
     {
-        fprintf(stderr, "[ERR] Failed to allocate memory. In \"array.c::arr_gc\".\n");
+        fprintf(stderr, "[ERR] Failed to allocate memory. In \"array.c::start_gc\".\n");
         destroy_ijvm_now();
     }
+    num_marked_arrays = arr_mem.size;
 
     mark_arrays();
-    num_freed = sweep_arrays();
+    if (g_prof_enabled)
+    {
+        prof_collect(marked_arrays, num_marked_arrays);
+    }
+    memset(arr_cache, 0, sizeof(arr_cache)); // Unmarked arrays must not be accessible any more
 
+    // Only existing arrays are swept, removing them reorders the live list so it is copied
+    if (arr_mem.num_live != 0)
+    {
+        memcpy(sweep_list, arr_mem.live, arr_mem.num_live * sizeof(uint32_t));
+    }
+    sweep_i = 0;
+    sweep_end = arr_mem.num_live;
     return num_freed;
 }
 
 
+uint32_t arr_gc(void)
+{
+    const uint32_t num_freed = start_gc();
+    return num_freed + sweep_arrays(SIZE_MAX_UINT32_T, SIZE_MAX_UINT32_T);
+}
+
+
+void arr_gc_lazy(void)
+{
+    start_gc();
+}
+
+
 void arr_print(const bool compact)
 {
     if (compact)
@@ -295,7 +1265,7 @@ void arr_print(const bool compact)
         {
             if (marr_check_marked(&arr_mem, i) == true)
             {
-                dprintf(" 0x%X", index_to_ref(i));
+                dprintf(" 0x%X", index_to_ref(i, ((const ArrHeader_t*)arr_mem.values[i])->kind));
             }
         }
         dprintf(" ]");
@@ -307,7 +1277,7 @@ void arr_print(const bool compact)
         {
             if (marr_check_marked(&arr_mem, i) == true)
             {
-                dprintf("\t0x%X\n", index_to_ref(i));
+                dprintf("\t0x%X\n", index_to_ref(i, ((const ArrHeader_t*)arr_mem.values[i])->kind));
             }
         }
     }
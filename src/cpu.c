@@ -31,6 +31,9 @@ bool stack_push(const word_t e)
         }
         (g_cpu->stack)[g_cpu->sp] = e;
     }
+#ifdef GC_TAGS
+    tag_set(g_cpu->stack_tags, (uint32_t)g_cpu->sp, false);
+#endif
     
     return true;
 }
@@ -47,6 +50,17 @@ word_t stack_pop(void)
 }
 
 
+word_t stack_peek(void)
+{
+    if (g_cpu->sp < g_cpu->lv || g_cpu->sp <= -1)
+    {
+        fprintf(stderr, "[ERR] Failed to peek at the stack because the stack is empty. In \"cpu.c::stack_peek\".\n");
+        destroy_ijvm_now();
+    }
+    return (g_cpu->stack)[g_cpu->sp];
+}
+
+
 /**
 * Makes the stack 8 times larger
 * Returns  true on success
@@ -57,6 +71,9 @@ static bool octuple_stack_size(void)
 {
     word_t* tmp_stack;
     int tmp_stack_size;
+#ifdef GC_TAGS
+    uint32_t* tmp_tags;
+#endif
     const uint64_t expected_size = (uint32_t)g_cpu->stack_size * sizeof(word_t) * 8;
     if (expected_size > 4294967296 || expected_size == 0)
     {
@@ -79,6 +96,17 @@ static bool octuple_stack_size(void)
         fprintf(stderr, "[ERR] Failed to allocate memory. In \"cpu.c::octuple_stack_size\".\n");
         destroy_ijvm_now();
     }
+#ifdef GC_TAGS
+    tmp_tags = (uint32_t*)realloc(g_cpu->stack_tags, TAG_WORDS(tmp_stack_size) * sizeof(uint32_t));
+    if (tmp_tags == NULL)
+    {
+        fprintf(stderr, "[ERR] Failed to allocate memory. In \"cpu.c::octuple_stack_size\".\n");
+        destroy_ijvm_now();
+    }
+    memset(&tmp_tags[TAG_WORDS(tmp_stack_size / 8)], 0,
+        (TAG_WORDS(tmp_stack_size) - TAG_WORDS(tmp_stack_size / 8)) * sizeof(uint32_t));
+    g_cpu->stack_tags = tmp_tags;
+#endif
 
     return true;
 }
@@ -135,6 +163,9 @@ void jump(const int32_t offset)
 void cpu_destroy(void)
 {
     free(g_cpu->stack);
+#ifdef GC_TAGS
+    free(g_cpu->stack_tags);
+#endif
     free(g_cpu->code_mem);
     free(g_cpu->const_mem);
 }
@@ -135,7 +135,7 @@ static bool read_symbol_block(FILE* f, SymbolBlock_t* symb_block)
 }
 
 
-bool load_debug_data(const char* prog_path)
+bool read_debug_data(const char* prog_path, DebugData_t* data)
 {
     FILE* f;
     bool read_success = true;
@@ -149,12 +149,22 @@ bool load_debug_data(const char* prog_path)
     fseek(f, 4, SEEK_CUR); // Skip magic number
     read_success = skip_block(f) ? (read_success && true) : false; // Skip constants
     read_success = skip_block(f) ? (read_success && true) : false; // Skip code
-    read_success = read_symbol_block(f, &g_debug_data->func_label) ? (read_success && true) : false; // Read function symbols
-    read_success = read_symbol_block(f, &g_debug_data->sec_label) ? (read_success && true) : false; // Read section symbols
+    read_success = read_symbol_block(f, &data->func_label) ? (read_success && true) : false; // Read function symbols
+    read_success = read_symbol_block(f, &data->sec_label) ? (read_success && true) : false; // Read section symbols
+    fclose(f);
     if (!read_success)
     {
-        destroy_debug_data();
-        init_debug_data();
+        free_debug_data(data);
+        return false;
+    }
+    return true;
+}
+
+
+bool load_debug_data(const char* prog_path)
+{
+    if (read_debug_data(prog_path, g_debug_data) != true)
+    {
         return false;
     }
 
@@ -166,7 +176,6 @@ bool load_debug_data(const char* prog_path)
     {
         printf("Debug symbols have been loaded.\n");
     }
-    fclose(f);
     return true;
 }
 
@@ -208,6 +217,15 @@ void destroy_debug_data(void)
 }
 
 
+void free_debug_data(DebugData_t* data)
+{
+    destroy_symbol_block(&data->func_label);
+    destroy_symbol_block(&data->sec_label);
+    init_symbol_block(&data->func_label);
+    init_symbol_block(&data->sec_label);
+}
+
+
 char* get_func_name(const uint32_t i)
 {
     return str_dup(&g_debug_data->func_label.names[g_debug_data->func_label.names_start[i]]);
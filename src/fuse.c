@@ -0,0 +1,58 @@
+#include "fuse.h"
+
+
+// Declarations of static functions
+static bool is_plain_op(const int32_t pc, const byte_t op);
+
+
+static bool fuse_enabled = true;
+
+
+/**
+* Return true if the byte at pc is the given op-code, it is always executed as an op-code,
+* and it is not prefixed by WIDE
+**/
+static bool is_plain_op(const int32_t pc, const byte_t op)
+{
+    if ((g_cpu->code_mem)[pc] != op || smap_is_op(pc) != true)
+    {
+        return false;
+    }
+    return pc == 0 || smap_is_op(pc - 1) != true || (g_cpu->code_mem)[pc - 1] != OP_WIDE;
+}
+
+
+void fuse_code(void)
+{
+    uint32_t num_fused = 0;
+
+    if (fuse_enabled != true)
+    {
+        return;
+    }
+
+    for (int32_t pc = 0; pc + 4 < g_cpu->code_mem_size; pc++)
+    {
+        if (is_plain_op(pc, OP_ILOAD) != true || is_plain_op(pc + 2, OP_ILOAD) != true)
+        {
+            continue;
+        }
+        if (is_plain_op(pc + 4, OP_IALOAD) == true)
+        {
+            (g_cpu->code_mem)[pc] = OP_FUSED_IALOAD;
+            num_fused++;
+        }
+        else if (is_plain_op(pc + 4, OP_IASTORE) == true)
+        {
+            (g_cpu->code_mem)[pc] = OP_FUSED_IASTORE;
+            num_fused++;
+        }
+    }
+    dprintf("[FUSED %u]\n", num_fused);
+}
+
+
+void fuse_set_enabled(const bool enabled)
+{
+    fuse_enabled = enabled;
+}
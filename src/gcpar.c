@@ -0,0 +1,384 @@
+#define _POSIX_C_SOURCE 200809L // sysconf
+
+
+#include <unistd.h>
+#include <sched.h>
+
+
+#include "gcpar.h"
+
+
+/**
+* A contiguous run of words that still has to be scanned
+**/
+typedef struct GcWork_t
+{
+    const word_t* words;
+    const uint32_t* tags; // Tag bitmap of the words (NULL if not tagged)
+    uint32_t num;
+}GcWork_t;
+
+
+/**
+* Work queue of one worker.
+* The owner pushes and pops at the top while other workers steal from the bottom.
+**/
+typedef struct GcQueue_t
+{
+    pthread_mutex_t lock;
+    GcWork_t* items;
+    uint32_t bottom;
+    uint32_t top;
+    uint32_t size;
+}GcQueue_t;
+
+
+/**
+* Everything the workers need to know about the collection in progress
+**/
+typedef struct GcJob_t
+{
+    const word_t* roots;
+    const uint32_t* root_tags;
+    uint32_t num_roots;
+    bool* marked;
+    uint32_t mask;
+    uint32_t pattern;
+    GcResolve_t resolve;
+    uint32_t pending; // Work items that were queued (or root chunks not yet scanned) but not yet finished
+}GcJob_t;
+
+
+// Declarations of static functions
+static void pool_init(void);
+static void* pool_thread(void* arg);
+static void worker_run(const uint32_t worker_i);
+static void worker_mark(const word_t ref);
+static void worker_push(const word_t* words, const uint32_t* tags, const uint32_t num);
+static bool worker_pop(GcQueue_t* queue, GcWork_t* work);
+static bool worker_steal(const uint32_t worker_i, GcWork_t* work);
+static void worker_process(const GcWork_t* work);
+static void worker_scan(const GcWork_t* work);
+
+
+static GcJob_t job;
+static GcQueue_t queues[GC_PARALLEL_MAX_THREADS];
+static pthread_t threads[GC_PARALLEL_MAX_THREADS];
+static uint32_t num_workers = 0; // 0 until the pool is started
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static uint64_t pool_epoch = 0; // Incremented for every collection
+static uint32_t pool_running = 0; // Pool threads still working on the current collection
+static bool pool_quit = false;
+
+static _Thread_local uint32_t tl_worker_i; // Index of the worker (and queue) of the current thread
+
+
+/**
+* Start the worker threads, one per online CPU (up to GC_PARALLEL_MAX_THREADS)
+**/
+static void pool_init(void)
+{
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1)
+    {
+        num_cpus = 1;
+    }
+    if (num_cpus > GC_PARALLEL_MAX_THREADS)
+    {
+        num_cpus = GC_PARALLEL_MAX_THREADS;
+    }
+
+    pool_quit = false;
+    num_workers = 0;
+    for (uint32_t worker_i = 0; worker_i < (uint32_t)num_cpus; worker_i++)
+    {
+        pthread_mutex_init(&queues[worker_i].lock, NULL);
+        queues[worker_i].items = NULL;
+        queues[worker_i].bottom = 0;
+        queues[worker_i].top = 0;
+        queues[worker_i].size = 0;
+        // Calling thread is worker 0, only queues of started workers stay initialised
+        if (worker_i != 0 && pthread_create(&threads[worker_i], NULL, pool_thread, (void*)(uintptr_t)worker_i) != 0)
+        {
+            pthread_mutex_destroy(&queues[worker_i].lock);
+            break; // Work with however many threads could be started
+        }
+        num_workers++;
+    }
+    dprintf("[GC POOL %u THREADS]\n", num_workers);
+}
+
+
+/**
+* Body of a pool thread: wait for a collection, help mark, repeat
+**/
+static void* pool_thread(void* arg)
+{
+    const uint32_t worker_i = (uint32_t)(uintptr_t)arg;
+    uint64_t seen_epoch = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    for (;;)
+    {
+        while (!pool_quit && pool_epoch == seen_epoch)
+        {
+            pthread_cond_wait(&pool_start, &pool_lock);
+        }
+        if (pool_quit)
+        {
+            break;
+        }
+        seen_epoch = pool_epoch;
+        pthread_mutex_unlock(&pool_lock);
+
+        worker_run(worker_i);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_running == 0)
+        {
+            pthread_cond_signal(&pool_done);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+
+/**
+* Scan this worker's share of the roots then drain (and steal) queued work until none is left
+**/
+static void worker_run(const uint32_t worker_i)
+{
+    const uint32_t chunk = ((job.num_roots + num_workers - 1) / num_workers + 31) & ~31u; // Whole tag words
+    const uint32_t start = worker_i * chunk;
+    GcWork_t work;
+
+    tl_worker_i = worker_i;
+    if (start < job.num_roots)
+    {
+        work.words = &job.roots[start];
+        work.tags = job.root_tags == NULL ? NULL : &job.root_tags[start / 32];
+        work.num = job.num_roots - start < chunk ? job.num_roots - start : chunk;
+        worker_scan(&work);
+    }
+    __atomic_sub_fetch(&job.pending, 1, __ATOMIC_ACQ_REL); // Root chunk done
+
+    for (;;)
+    {
+        if (worker_pop(&queues[worker_i], &work) || worker_steal(worker_i, &work))
+        {
+            worker_process(&work);
+        }
+        else if (__atomic_load_n(&job.pending, __ATOMIC_ACQUIRE) == 0)
+        {
+            break;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
+
+
+/**
+* Scan callback: mark the referenced array and queue its elements if this thread marked it first
+**/
+static void worker_mark(const word_t ref)
+{
+    uint32_t arr_i;
+    uint32_t num_els;
+    const uint32_t* tags;
+    const word_t* els = job.resolve(ref, &arr_i, &num_els, &tags);
+
+    if (els == NULL || __atomic_exchange_n(&job.marked[arr_i], true, __ATOMIC_RELAXED) == true)
+    {
+        return;
+    }
+    for (uint32_t start = 0; start < num_els; start += GC_PARALLEL_CHUNK)
+    {
+        worker_push(&els[start], tags == NULL ? NULL : &tags[start / 32],
+            num_els - start < GC_PARALLEL_CHUNK ? num_els - start : GC_PARALLEL_CHUNK);
+    }
+}
+
+
+/**
+* Queue words to be scanned on the current worker's queue
+**/
+static void worker_push(const word_t* words, const uint32_t* tags, const uint32_t num)
+{
+    GcQueue_t* queue = &queues[tl_worker_i];
+    GcWork_t work = { words, tags, num };
+    GcWork_t* tmp_items;
+
+    __atomic_add_fetch(&job.pending, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&queue->lock);
+    if (queue->top == queue->size)
+    {
+        tmp_items = (GcWork_t*)realloc(queue->items, (queue->size * 2 + 64) * sizeof(GcWork_t));
+        if (tmp_items == NULL)
+        {
+            // No memory for the queue, scan the words right away instead
+            pthread_mutex_unlock(&queue->lock);
+            worker_process(&work);
+            return;
+        }
+        queue->items = tmp_items;
+        queue->size = queue->size * 2 + 64;
+    }
+    queue->items[queue->top++] = work;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+
+/**
+* Take the most recently queued work item of a queue (owner side)
+**/
+static bool worker_pop(GcQueue_t* queue, GcWork_t* work)
+{
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->top > queue->bottom)
+    {
+        *work = queue->items[--queue->top];
+        found = true;
+    }
+    if (queue->top == queue->bottom)
+    {
+        queue->top = 0;
+        queue->bottom = 0;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+
+/**
+* Take the oldest work item from another worker's queue
+**/
+static bool worker_steal(const uint32_t worker_i, GcWork_t* work)
+{
+    GcQueue_t* queue;
+    bool found = false;
+
+    for (uint32_t offset = 1; offset < num_workers && !found; offset++)
+    {
+        queue = &queues[(worker_i + offset) % num_workers];
+        if (pthread_mutex_trylock(&queue->lock) != 0)
+        {
+            continue; // Busy, try someone else
+        }
+        if (queue->top > queue->bottom)
+        {
+            *work = queue->items[queue->bottom++];
+            found = true;
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return found;
+}
+
+
+/**
+* Scan one work item and account for it being done
+**/
+static void worker_process(const GcWork_t* work)
+{
+    worker_scan(work);
+    __atomic_sub_fetch(&job.pending, 1, __ATOMIC_ACQ_REL);
+}
+
+
+/**
+* Mark arrays referenced by the words of a work item
+**/
+static void worker_scan(const GcWork_t* work)
+{
+    if (work->tags != NULL)
+    {
+        scan_tagged(work->words, work->tags, work->num, worker_mark);
+    }
+    else
+    {
+        scan_words(work->words, work->num, job.mask, job.pattern, worker_mark);
+    }
+}
+
+
+void gcpar_mark(const word_t* roots, const uint32_t* root_tags, const uint32_t num_roots, bool* marked,
+    const uint32_t mask, const uint32_t pattern, GcResolve_t resolve)
+{
+    if (num_workers == 0)
+    {
+        pool_init();
+    }
+
+    job.roots = roots;
+    job.root_tags = root_tags;
+    job.num_roots = num_roots;
+    job.marked = marked;
+    job.mask = mask;
+    job.pattern = pattern;
+    job.resolve = resolve;
+    job.pending = num_workers; // One root chunk per worker
+
+    pthread_mutex_lock(&pool_lock);
+    pool_running = num_workers - 1;
+    pool_epoch++;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+
+    worker_run(0);
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_running > 0)
+    {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+
+uint32_t gcpar_num_workers(void)
+{
+    if (num_workers == 0)
+    {
+        pool_init();
+    }
+    return num_workers;
+}
+
+
+void gcpar_destroy(void)
+{
+    if (num_workers == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    pool_quit = true;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (uint32_t worker_i = 1; worker_i < num_workers; worker_i++)
+    {
+        pthread_join(threads[worker_i], NULL);
+    }
+    for (uint32_t worker_i = 0; worker_i < num_workers; worker_i++)
+    {
+        free(queues[worker_i].items);
+        queues[worker_i].items = NULL;
+        pthread_mutex_destroy(&queues[worker_i].lock);
+    }
+    num_workers = 0;
+
+    // A pool started later must not take the last collection for a pending one
+    pool_epoch = 0;
+    pool_running = 0;
+    memset(&job, 0, sizeof(GcJob_t));
+}
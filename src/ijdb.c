@@ -835,6 +835,7 @@ int main(int argc, char** argv)
 
     init_debug_data();
     init_debugger();
+    fuse_set_enabled(false); // Breakpoints and disassembly refer to the code as it was loaded
     using_history();
 
     while (g_dbg_state->quit_flag != true)
@@ -44,6 +44,7 @@ static int32_t get_num_local_vars_main(void)
             continue;
 
         case OP_INVOKEVIRTUAL:
+        case OP_SPAWN:
             addr = get_constant(get_code_short((int)i + 1));
             if (addr > 0 && addr < (int64_t)addr_first_method_after_main && addr < g_cpu->code_mem_size)
             {
@@ -79,6 +80,9 @@ static int32_t get_num_local_vars_main(void)
             continue;
 
         case OP_BIPUSH:
+        case OP_MULTINEWARRAY:
+        case OP_MALOAD:
+        case OP_MASTORE:
             i += 1;
             continue;
 
@@ -108,11 +112,26 @@ static int32_t get_num_local_vars_main(void)
         case OP_NEWARRAY:
         case OP_IALOAD:
         case OP_IASTORE:
+        case OP_ARRAYCOPY:
+        case OP_ARRAYFILL:
+        case OP_NEWBYTEARRAY:
+        case OP_BALOAD:
+        case OP_BASTORE:
+        case OP_INMAP:
+        case OP_INARRAY:
+        case OP_OUTARRAY:
         case OP_NETBIND:
         case OP_NETCONNECT:
         case OP_NETIN:
         case OP_NETOUT:
         case OP_NETCLOSE:
+        case OP_NETLISTEN:
+        case OP_NETACCEPT:
+        case OP_NETPOLL:
+        case OP_NETINARRAY:
+        case OP_NETOUTARRAY:
+        case OP_YIELD:
+        case OP_JOIN:
             // All these instructions don't take arguments
             continue;
         */
@@ -146,7 +165,12 @@ static void init_stack(void)
     }
     tmp_mem_size = g_cpu->stack_size;
     g_cpu->stack = (word_t*)malloc((uint32_t)tmp_mem_size * sizeof(word_t));
+#ifdef GC_TAGS
+    g_cpu->stack_tags = (uint32_t*)calloc(TAG_WORDS(tmp_mem_size), sizeof(uint32_t)); // No word is a reference yet
+    if (g_cpu->stack == NULL || g_cpu->stack_tags == NULL)
+#else
     if (g_cpu->stack == NULL)
+#endif
     {
         fprintf(stderr, "[ERR] Failed to allocate memory. In \"init.c::init_stack\".\n");
         destroy_ijvm_now();
@@ -191,9 +215,13 @@ int init_ijvm(const char* binary_path)
     init_registers();
     init_stack();
     init_cpu_flags();
+    smap_build();
+    fuse_code();
     set_output(stdout);
     set_input(stdin);
     init_interpreter();
+    scan_init();
+    prof_init(binary_path);
     // At this point the CPU memory is well defined
 
     return 0;
@@ -202,11 +230,11 @@ int init_ijvm(const char* binary_path)
 
 void set_output(FILE* f)
 {
-    g_out_file = f;
+    io_set_output(f);
 }
 
 
 void set_input(FILE* f)
 {
-    g_in_file = f;
+    io_set_input(f);
 }
@@ -30,21 +30,61 @@ static inline void exec_op_out(void);
 static inline void exec_op_err(void);
 static inline void exec_op_halt(void);
 
+static inline int32_t alloc_frame(void);
 static inline void exec_op_newarray(void);
 static inline void exec_op_iaload(void);
 static inline void exec_op_iastore(void);
 static inline void exec_op_gc(void);
+static inline void exec_op_arraycopy(void);
+static inline void exec_op_arrayfill(void);
+static inline void exec_op_newbytearray(void);
+static inline void exec_op_baload(void);
+static inline void exec_op_bastore(void);
+static inline void exec_op_multinewarray(void);
+static inline void exec_op_maload(void);
+static inline void exec_op_mastore(void);
+static inline uint32_t pop_dims(word_t* vals);
+static inline void exec_op_inmap(void);
+static inline void exec_op_inarray(void);
+static inline void exec_op_outarray(void);
+static inline void exec_op_fused_iaload(void);
+static inline void exec_op_fused_iastore(void);
 
 static inline void exec_op_netbind(void);
 static inline void exec_op_netconnect(void);
 static inline void exec_op_netin(void);
 static inline void exec_op_netout(void);
 static inline void exec_op_netclose(void);
+static inline void exec_op_netlisten(void);
+static inline void exec_op_netaccept(void);
+static inline void exec_op_netpoll(void);
+static inline void exec_op_netinarray(void);
+static inline void exec_op_netoutarray(void);
+
+static inline bool park_op(const int fd, const uint32_t events);
+static inline bool park_input(void);
+static inline bool park_net(void);
+static inline void exec_op_spawn(void);
+static inline void exec_op_yield(void);
+static inline void exec_op_join(void);
 
 
 static bool next_op_wide = false;
 
 
+/**
+* Read and write the tag (reference or not) of the i'th stack word.
+* Without GC_TAGS no tags are kept and every word reads as untagged.
+**/
+#ifdef GC_TAGS
+#define STACK_TAG(i) tag_get(g_cpu->stack_tags, (uint32_t)(i))
+#define SET_STACK_TAG(i, tag) tag_set(g_cpu->stack_tags, (uint32_t)(i), tag)
+#else
+#define STACK_TAG(i) false
+#define SET_STACK_TAG(i, tag) ((void)(tag))
+#endif
+
+
 /**
 * Get a one byte argument from code memory and increment PC
 **/
@@ -52,7 +92,7 @@ static inline byte_t get_arg_byte(void)
 {
     if (g_cpu->pc + 1 > g_cpu->code_mem_size)
     {
-        fprintf(stderr, "[ERR] Program counter was moved beyond code memory. In \"interpreter.c::get_arg_short\".\n");
+        fprintf(stderr, "[ERR] Program counter was moved beyond code memory. In \"interpreter.c::get_arg_byte\".\n");
         destroy_ijvm_now();
     }
     return (g_cpu->code_mem)[g_cpu->pc++];
@@ -107,12 +147,14 @@ static inline void exec_op_iload(void)
         var_i = (uint16_t)get_arg_byte();
     }
     stack_push(get_local_variable(var_i));
+    SET_STACK_TAG(g_cpu->sp, STACK_TAG(g_cpu->lv + var_i));
 }
 
 
 static inline void exec_op_istore(void)
 {
     uint16_t var_i;
+    const bool tag = STACK_TAG(g_cpu->sp);
     const word_t val = stack_pop();
     if (next_op_wide)
     {
@@ -123,6 +165,7 @@ static inline void exec_op_istore(void)
         var_i = (uint16_t)get_arg_byte();
     }
     update_local_variable(val, var_i);
+    SET_STACK_TAG(g_cpu->lv + var_i, tag);
 }
 
 
@@ -134,16 +177,22 @@ static inline void exec_op_pop(void)
 
 static inline void exec_op_dup(void)
 {
+    const bool tag = STACK_TAG(g_cpu->sp);
     stack_push((g_cpu->stack)[g_cpu->sp]);
+    SET_STACK_TAG(g_cpu->sp, tag);
 }
 
 
 static inline void exec_op_swap(void)
 {
+    const bool tag_b = STACK_TAG(g_cpu->sp);
     const word_t b = stack_pop();
+    const bool tag_a = STACK_TAG(g_cpu->sp);
     const word_t a = stack_pop();
     stack_push(b);
+    SET_STACK_TAG(g_cpu->sp, tag_b);
     stack_push(a);
+    SET_STACK_TAG(g_cpu->sp, tag_a);
 }
 
 
@@ -185,6 +234,7 @@ static inline void exec_op_iinc(void)
     }
     c = (int8_t)get_arg_byte();
     update_local_variable((int32_t)(get_local_variable(var_i) + c), var_i);
+    SET_STACK_TAG(g_cpu->lv + var_i, false);
 }
 
 
@@ -227,8 +277,15 @@ static inline void exec_op_goto(void)
 
 static inline void exec_op_ireturn(void)
 {
+    const bool ret_tag = STACK_TAG(g_cpu->sp);
     const word_t ret_val = stack_pop();
     const int old_nv = g_cpu->nv;
+    const int old_fp = g_cpu->fp;
+
+    if (g_threads == true && thread_end(old_fp, ret_val, ret_tag))
+    {
+        return; // Thread returned from the method it was spawned with, another one runs now
+    }
 
     g_cpu->sp = g_cpu->fp + 3;
     g_cpu->pc = stack_pop();
@@ -246,7 +303,12 @@ static inline void exec_op_ireturn(void)
         fprintf(stderr, "[ERR] Program tried removing a stack frame that did not exist. In \"interpreter.c::exec_op_ireturn\".\n");
         destroy_ijvm_now();
     }
+    if (thread_in_main())
+    {
+        arr_release_frame(old_fp); // Other threads have no arrays local to their frames
+    }
     stack_push(ret_val);
+    SET_STACK_TAG(g_cpu->sp, ret_tag);
 }
 
 
@@ -296,6 +358,12 @@ static inline void exec_op_invokevirtual(void)
     }
 
     memset(&g_cpu->stack[g_cpu->lv + num_args], 0, (uint16_t)num_locals * sizeof(uint32_t)); // Init local variables to 0
+#ifdef GC_TAGS
+    for (uint16_t local_i = 0; local_i < num_locals; local_i++)
+    {
+        SET_STACK_TAG(g_cpu->lv + num_args + local_i, false);
+    }
+#endif
 
     /**
     * Stack after call:
@@ -322,7 +390,12 @@ static inline void exec_op_wide(void)
 
 static inline void exec_op_in(void)
 {
-    const word_t c = getc(g_in_file);
+    int32_t c;
+    if (park_input())
+    {
+        return;
+    }
+    c = io_get();
     if (c == EOF)
     {
         stack_push(0);
@@ -336,27 +409,44 @@ static inline void exec_op_in(void)
 
 static inline void exec_op_out(void)
 {
-    const char data = (char)stack_pop();
-    fprintf(g_out_file, "%c", data);
+    io_put((byte_t)stack_pop());
 }
 
 
 static inline void exec_op_err(void)
 {
+    io_flush();
     g_cpu->error_flag = true;
 }
 
 
 static inline void exec_op_halt(void)
 {
+    io_flush();
     g_cpu->halt_flag = true;
 }
 
 
+/**
+* Called by instructions creating arrays right after their op-code was fetched (before any argument)
+* Return  frame pointer of the frame an array created by the instruction just fetched is local to
+*         -1 if the array may outlive the frame
+**/
+static inline int32_t alloc_frame(void)
+{
+    if (g_prof_enabled)
+    {
+        prof_site(g_cpu->pc - 1);
+    }
+    return smap_is_frame_local(g_cpu->pc - 1) && thread_in_main() ? g_cpu->fp : -1;
+}
+
+
 static inline void exec_op_newarray(void)
 {
     const word_t count = stack_pop();
-    stack_push(arr_create(count));
+    stack_push(arr_create(count, alloc_frame()));
+    SET_STACK_TAG(g_cpu->sp, true);
 }
 
 
@@ -364,7 +454,14 @@ static inline void exec_op_iaload(void)
 {
     const word_t array_ref = stack_pop();
     const word_t i = stack_pop();
+#ifdef GC_TAGS
+    bool tag;
+    const word_t val = arr_get_tagged(array_ref, i, &tag);
+    stack_push(val);
+    SET_STACK_TAG(g_cpu->sp, tag);
+#else
     stack_push(arr_get(array_ref, i));
+#endif
 }
 
 
@@ -372,8 +469,14 @@ static inline void exec_op_iastore(void)
 {
     const word_t array_ref = stack_pop();
     const word_t i = stack_pop();
+#ifdef GC_TAGS
+    const bool tag = STACK_TAG(g_cpu->sp);
+    const word_t val = stack_pop();
+    arr_set_tagged(array_ref, i, val, tag);
+#else
     const word_t val = stack_pop();
     arr_set(array_ref, i, val);
+#endif
 }
 
 
@@ -383,6 +486,197 @@ static inline void exec_op_gc(void)
 }
 
 
+static inline void exec_op_arraycopy(void)
+{
+    const word_t len = stack_pop();
+    const word_t dst_pos = stack_pop();
+    const word_t dst_ref = stack_pop();
+    const word_t src_pos = stack_pop();
+    const word_t src_ref = stack_pop();
+    arr_copy(src_ref, src_pos, dst_ref, dst_pos, len);
+}
+
+
+static inline void exec_op_arrayfill(void)
+{
+#ifdef GC_TAGS
+    const bool tag = STACK_TAG(g_cpu->sp);
+#endif
+    const word_t val = stack_pop();
+    const word_t to = stack_pop();
+    const word_t from = stack_pop();
+    const word_t array_ref = stack_pop();
+#ifdef GC_TAGS
+    arr_fill_tagged(array_ref, from, to, val, tag);
+#else
+    arr_fill(array_ref, from, to, val);
+#endif
+}
+
+
+static inline void exec_op_newbytearray(void)
+{
+    const word_t count = stack_pop();
+    stack_push(arr_create_bytes(count, alloc_frame()));
+    SET_STACK_TAG(g_cpu->sp, true);
+}
+
+
+static inline void exec_op_baload(void)
+{
+    const word_t array_ref = stack_pop();
+    const word_t i = stack_pop();
+    stack_push(arr_get_byte(array_ref, i));
+}
+
+
+static inline void exec_op_bastore(void)
+{
+    const word_t array_ref = stack_pop();
+    const word_t i = stack_pop();
+    const word_t val = stack_pop();
+    arr_set_byte(array_ref, i, val);
+}
+
+
+/**
+* Read the number of dimensions argument and pop that many words (pushed outermost first).
+* Return  number of dimensions
+**/
+static inline uint32_t pop_dims(word_t* vals)
+{
+    const uint32_t num_dims = get_arg_byte();
+    if (num_dims == 0 || num_dims > ARRAYS_MAX_DIMS)
+    {
+        fprintf(stderr, "[ERR] Invalid number of array dimensions. In \"interpreter.c::pop_dims\".\n");
+        destroy_ijvm_now();
+    }
+    for (uint32_t dim_i = num_dims; dim_i > 0; dim_i--)
+    {
+        vals[dim_i - 1] = stack_pop();
+    }
+    return num_dims;
+}
+
+
+static inline void exec_op_multinewarray(void)
+{
+    word_t sizes[ARRAYS_MAX_DIMS];
+    const int32_t frame = alloc_frame(); // Before the argument is fetched
+    const uint32_t num_dims = pop_dims(sizes);
+    stack_push(arr_create_multi(num_dims, sizes, frame));
+    SET_STACK_TAG(g_cpu->sp, true);
+}
+
+
+static inline void exec_op_maload(void)
+{
+    word_t indices[ARRAYS_MAX_DIMS];
+    const word_t array_ref = stack_pop();
+    const uint32_t num_dims = pop_dims(indices);
+    const word_t i = arr_multi_index(array_ref, num_dims, indices);
+#ifdef GC_TAGS
+    bool tag;
+    const word_t val = arr_get_tagged(array_ref, i, &tag);
+    stack_push(val);
+    SET_STACK_TAG(g_cpu->sp, tag);
+#else
+    stack_push(arr_get(array_ref, i));
+#endif
+}
+
+
+static inline void exec_op_mastore(void)
+{
+    word_t indices[ARRAYS_MAX_DIMS];
+    const word_t array_ref = stack_pop();
+    const uint32_t num_dims = pop_dims(indices);
+    const word_t i = arr_multi_index(array_ref, num_dims, indices);
+#ifdef GC_TAGS
+    const bool tag = STACK_TAG(g_cpu->sp);
+    const word_t val = stack_pop();
+    arr_set_tagged(array_ref, i, val, tag);
+#else
+    const word_t val = stack_pop();
+    arr_set(array_ref, i, val);
+#endif
+}
+
+
+static inline void exec_op_inmap(void)
+{
+    if (g_prof_enabled)
+    {
+        prof_site(g_cpu->pc - 1);
+    }
+    stack_push(io_map_input());
+    SET_STACK_TAG(g_cpu->sp, true);
+}
+
+
+static inline void exec_op_inarray(void)
+{
+    word_t len, from, array_ref;
+    if (park_input())
+    {
+        return;
+    }
+    len = stack_pop();
+    from = stack_pop();
+    array_ref = stack_pop();
+    stack_push(arr_input(array_ref, from, len));
+}
+
+
+static inline void exec_op_outarray(void)
+{
+    const word_t len = stack_pop();
+    const word_t from = stack_pop();
+    const word_t array_ref = stack_pop();
+    arr_output(array_ref, from, len);
+}
+
+
+/**
+* ILOAD index_var; ILOAD ref_var; IALOAD
+**/
+static inline void exec_op_fused_iaload(void)
+{
+    const byte_t index_var = get_arg_byte();
+    g_cpu->pc++; // Second ILOAD
+    const byte_t ref_var = get_arg_byte();
+    g_cpu->pc++; // IALOAD
+#ifdef GC_TAGS
+    bool tag;
+    const word_t val = arr_get_tagged(get_local_variable(ref_var), get_local_variable(index_var), &tag);
+    stack_push(val);
+    SET_STACK_TAG(g_cpu->sp, tag);
+#else
+    stack_push(arr_get(get_local_variable(ref_var), get_local_variable(index_var)));
+#endif
+}
+
+
+/**
+* ILOAD index_var; ILOAD ref_var; IASTORE
+**/
+static inline void exec_op_fused_iastore(void)
+{
+    const byte_t index_var = get_arg_byte();
+    g_cpu->pc++; // Second ILOAD
+    const byte_t ref_var = get_arg_byte();
+    g_cpu->pc++; // IASTORE
+#ifdef GC_TAGS
+    const bool tag = STACK_TAG(g_cpu->sp);
+    const word_t val = stack_pop();
+    arr_set_tagged(get_local_variable(ref_var), get_local_variable(index_var), val, tag);
+#else
+    const word_t val = stack_pop();
+    arr_set(get_local_variable(ref_var), get_local_variable(index_var), val);
+#endif
+}
+
+
 static inline void exec_op_netbind(void)
 {
     const word_t port = stack_pop();
@@ -400,7 +694,12 @@ static inline void exec_op_netconnect(void)
 
 static inline void exec_op_netin(void)
 {
-    const word_t net_ref = stack_pop();
+    word_t net_ref;
+    if (park_net())
+    {
+        return;
+    }
+    net_ref = stack_pop();
     stack_push(net_recv(net_ref));
 }
 
@@ -420,6 +719,145 @@ static inline void exec_op_netclose(void)
 }
 
 
+static inline void exec_op_netlisten(void)
+{
+    const word_t port = stack_pop();
+    stack_push(net_listen(port));
+}
+
+
+static inline void exec_op_netaccept(void)
+{
+    word_t net_ref;
+    if (park_net())
+    {
+        return;
+    }
+    net_ref = stack_pop();
+    stack_push(net_accept(net_ref));
+}
+
+
+static inline void exec_op_netpoll(void)
+{
+    const word_t timeout = stack_pop();
+    stack_push(net_poll(timeout));
+}
+
+
+static inline void exec_op_netinarray(void)
+{
+    word_t net_ref, len, from, array_ref;
+    if (park_net())
+    {
+        return;
+    }
+    net_ref = stack_pop();
+    len = stack_pop();
+    from = stack_pop();
+    array_ref = stack_pop();
+    stack_push(arr_net_input(array_ref, from, len, net_ref));
+}
+
+
+static inline void exec_op_netoutarray(void)
+{
+    const word_t net_ref = stack_pop();
+    const word_t len = stack_pop();
+    const word_t from = stack_pop();
+    const word_t array_ref = stack_pop();
+    stack_push(arr_net_output(array_ref, from, len, net_ref));
+}
+
+
+/**
+* Park the running thread until 'fd' is ready (see thread_park) unless it is -1. The instruction
+* just fetched (which has no arguments) is executed again once the thread runs again.
+* Return  true if the thread was parked (another thread runs now)
+**/
+static inline bool park_op(const int fd, const uint32_t events)
+{
+    if (fd == -1)
+    {
+        return false;
+    }
+    g_cpu->pc--;
+    if (thread_park(fd, events))
+    {
+        return true;
+    }
+    g_cpu->pc++;
+    return false;
+}
+
+
+/**
+* With threads, park the running thread instead of waiting for input
+**/
+static inline bool park_input(void)
+{
+    uint32_t events;
+    int fd;
+    if (g_threads != true || g_in_pos < g_in_end)
+    {
+        return false;
+    }
+    fd = io_wait_fd(&events);
+    return park_op(fd, events);
+}
+
+
+/**
+* With threads, park the running thread instead of waiting for (or pushing that there is no)
+* input or connection on the network reference on top of the stack
+**/
+static inline bool park_net(void)
+{
+    uint32_t events;
+    int fd;
+    if (g_threads != true)
+    {
+        return false;
+    }
+    fd = net_wait_fd(stack_peek(), &events);
+    return park_op(fd, events);
+}
+
+
+static inline void exec_op_spawn(void)
+{
+    const word_t offset = get_constant(get_arg_short());
+    if (offset < 0 || offset + 4 > g_cpu->code_mem_size)
+    {
+        fprintf(stderr, "[ERR] Invalid method address. In \"interpreter.c::exec_op_spawn\".\n");
+        destroy_ijvm_now();
+    }
+    stack_push(thread_spawn(offset));
+}
+
+
+static inline void exec_op_yield(void)
+{
+    thread_yield();
+}
+
+
+static inline void exec_op_join(void)
+{
+    word_t result;
+    bool tag;
+    g_cpu->pc--; // JOIN is executed again once the thread ended
+    if (thread_join(stack_peek(), &result, &tag) != true)
+    {
+        return;
+    }
+    g_cpu->pc++;
+    stack_pop();
+    stack_push(result);
+    SET_STACK_TAG(g_cpu->sp, tag);
+}
+
+
 void run(void)
 {
     dprintf("[VM START]\n");
@@ -427,6 +865,7 @@ void run(void)
     {
         step();
     }
+    io_flush();
     dprintf("[VM STOP]\n");
 }
 
@@ -524,6 +963,45 @@ bool step(void)
     case OP_GC:
         exec_op_gc();
         break;
+    case OP_ARRAYCOPY:
+        exec_op_arraycopy();
+        break;
+    case OP_ARRAYFILL:
+        exec_op_arrayfill();
+        break;
+    case OP_NEWBYTEARRAY:
+        exec_op_newbytearray();
+        break;
+    case OP_BALOAD:
+        exec_op_baload();
+        break;
+    case OP_BASTORE:
+        exec_op_bastore();
+        break;
+    case OP_MULTINEWARRAY:
+        exec_op_multinewarray();
+        break;
+    case OP_MALOAD:
+        exec_op_maload();
+        break;
+    case OP_MASTORE:
+        exec_op_mastore();
+        break;
+    case OP_INMAP:
+        exec_op_inmap();
+        break;
+    case OP_INARRAY:
+        exec_op_inarray();
+        break;
+    case OP_OUTARRAY:
+        exec_op_outarray();
+        break;
+    case OP_FUSED_IALOAD:
+        exec_op_fused_iaload();
+        break;
+    case OP_FUSED_IASTORE:
+        exec_op_fused_iastore();
+        break;
     case OP_NETBIND:
         exec_op_netbind();
         break;
@@ -539,6 +1017,30 @@ bool step(void)
     case OP_NETCLOSE:
         exec_op_netclose();
         break;
+    case OP_NETLISTEN:
+        exec_op_netlisten();
+        break;
+    case OP_NETACCEPT:
+        exec_op_netaccept();
+        break;
+    case OP_NETPOLL:
+        exec_op_netpoll();
+        break;
+    case OP_NETINARRAY:
+        exec_op_netinarray();
+        break;
+    case OP_NETOUTARRAY:
+        exec_op_netoutarray();
+        break;
+    case OP_SPAWN:
+        exec_op_spawn();
+        break;
+    case OP_YIELD:
+        exec_op_yield();
+        break;
+    case OP_JOIN:
+        exec_op_join();
+        break;
     default:
         fprintf(stderr, "[ERR] Invalid instruction. In \"interpreter.c::step\".\n");
         g_cpu->error_flag = true;
@@ -0,0 +1,766 @@
+#define _DEFAULT_SOURCE // fileno, madvise
+
+
+#include <errno.h>
+#include <pthread.h>
+
+
+#include "io.h"
+
+
+// Declarations of static functions
+static void in_open(void);
+static void in_close(void);
+static void out_write(const byte_t* src, const size_t len);
+static void out_push(void);
+static void out_wait(const uint32_t max_full);
+static void out_wake(void);
+static void* out_thread(void* arg);
+static void out_start(void);
+static void out_stop(void);
+static bool ring_start(void);
+static void ring_handle(const struct io_uring_cqe* cqe);
+static void out_ring_write(const uint32_t buf_i, const uint32_t done);
+static void out_ring_wait(void);
+static void in_ring_read(void);
+static int32_t in_ring_refill(void);
+
+
+const byte_t* g_in_pos = NULL;
+const byte_t* g_in_end = NULL;
+
+static byte_t out_bufs[2][IO_OUT_BUFFER_SIZE]; // Only the first one is used unless writing asynchronously
+static byte_t* out_buf = out_bufs[0]; // Buffer OUT appends to
+static uint32_t out_len = 0; // Bytes of out_buf not written yet
+static bool out_tty = false; // Output goes to a terminal, flush every line
+
+/**
+* Asynchronous output: the VM fills one buffer while the writer thread drains the other.
+* Buffers are handed over in turns through out_full (buffers waiting to be written, 0 to 2) which
+* only ever changes atomically. A side that has to wait sleeps on out_cond after announcing it in
+* out_sleeping, the other side only takes the lock to wake it up.
+**/
+static bool out_async = false; // Writer thread is running
+static pthread_t out_writer;
+static uint32_t out_lens[2]; // Bytes to write of each buffer handed over
+static uint32_t out_push_i = 0; // Buffer the VM fills
+static uint32_t out_full = 0;
+static uint32_t out_sleeping = 0; // Sides waiting on out_cond
+static bool out_quit = false;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t out_cond = PTHREAD_COND_INITIALIZER;
+
+static FILE* in_file = NULL;
+static bool in_opened = false; // Input was mapped or got a buffer
+static bool in_eof = false; // No more input will be read
+static byte_t* in_map = NULL; // Mapping of a regular input file (NULL if not mapped)
+static size_t in_map_size = 0;
+static byte_t in_bufs[2][IO_IN_BUFFER_SIZE]; // Refill buffers of any other input, the second is only used with io_uring
+static byte_t* in_buf = NULL; // Refill buffer (NULL if the input is mapped)
+
+/**
+* io_uring: the full output buffer is written by a request while the VM fills the other one (the
+* next request is only made once the last completed, which keeps the output in order), and input
+* is read into one buffer while the VM consumes the other. Both use the buffers as fixed buffers
+* (out_bufs are 0 and 1, in_bufs 2 and 3).
+**/
+enum { RING_OUT, RING_IN };
+static bool ring_registered = false; // Buffers are registered with the ring
+static bool out_ring = false; // Output is written with io_uring
+static bool out_writing = false; // A write request is under way
+static uint32_t out_write_i = 0; // Buffer being written
+static uint32_t out_write_done = 0; // Bytes of it written already
+static bool in_ring = false; // Input is read with io_uring
+static bool in_reading = false; // A read request is under way
+static bool in_read_made = false; // A read request was made and its input was not taken yet
+static int32_t in_read_len = 0; // Result of the last read request
+static uint32_t in_read_i = 0; // Buffer the next read request fills
+
+
+/**
+* Map a regular input file as a whole, starting from the current position of the stream.
+* Anything else gets a refill buffer.
+**/
+static void in_open(void)
+{
+    const int fd = fileno(in_file);
+    const long pos = ftell(in_file); // Takes data already buffered by stdio into account
+    struct stat st;
+    void* mem;
+
+    in_opened = true;
+    if (pos >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX)
+    {
+        if (st.st_size <= pos)
+        {
+            in_eof = true;
+            return;
+        }
+        mem = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem != MAP_FAILED)
+        {
+            madvise(mem, (size_t)st.st_size, MADV_SEQUENTIAL); // Only a hint, read ahead aggressively
+            in_map = (byte_t*)mem;
+            in_map_size = (size_t)st.st_size;
+            g_in_pos = &in_map[pos];
+            g_in_end = &in_map[in_map_size];
+            return;
+        }
+        lseek(fd, (off_t)pos, SEEK_SET); // Read it instead, from where the stream is
+    }
+
+    in_buf = in_bufs[0];
+    in_ring = ring_start();
+    in_read_i = 0;
+}
+
+
+/**
+* Unmap or free the input and forget the file
+**/
+static void in_close(void)
+{
+    struct io_uring_sqe* sqe;
+
+    if (in_reading == true)
+    {
+        // Nothing may be read into the buffers once the input is released
+        sqe = uring_sqe(uring_data(URING_IGNORE, 0, NULL));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = uring_data(URING_IO, RING_IN, NULL);
+        while (in_reading == true)
+        {
+            uring_wait(-1);
+        }
+    }
+    if (in_map != NULL)
+    {
+        munmap(in_map, in_map_size);
+    }
+    in_ring = false;
+    in_read_made = false;
+    in_map = NULL;
+    in_map_size = 0;
+    in_buf = NULL;
+    in_opened = false;
+    in_eof = false;
+    g_in_pos = NULL;
+    g_in_end = NULL;
+}
+
+
+/**
+* Write bytes to the output file right away
+**/
+static void out_write(const byte_t* src, const size_t len)
+{
+    size_t done = 0;
+    ssize_t num_written;
+
+    if (g_out_file == NULL)
+    {
+        return;
+    }
+    if (out_async != true)
+    {
+        if (fwrite(src, 1, len, g_out_file) != len)
+        {
+            fprintf(stderr, "[ERR] Failed to write output. In \"io.c::out_write\".\n");
+        }
+        fflush(g_out_file);
+        return;
+    }
+
+    // Writer thread, straight to the file descriptor (stdio was flushed before it started)
+    while (done < len)
+    {
+        num_written = write(fileno(g_out_file), &src[done], len - done);
+        if (num_written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (num_written <= 0)
+        {
+            fprintf(stderr, "[ERR] Failed to write output. In \"io.c::out_write\".\n");
+            return;
+        }
+        done += (size_t)num_written;
+    }
+}
+
+
+/**
+* Write out the buffer OUT appends to (or hand it to the writer thread and continue with the other)
+**/
+static void out_push(void)
+{
+    if (out_ring == true)
+    {
+        out_lens[out_push_i] = out_len;
+        out_ring_wait(); // The other buffer is written before this one
+        out_ring_write(out_push_i, 0);
+        out_push_i ^= 1;
+        out_buf = out_bufs[out_push_i];
+        out_len = 0;
+        return;
+    }
+    if (out_async != true)
+    {
+        out_write(out_buf, out_len);
+        out_len = 0;
+        return;
+    }
+
+    out_lens[out_push_i] = out_len;
+    __atomic_add_fetch(&out_full, 1, __ATOMIC_SEQ_CST);
+    out_wake();
+    out_push_i ^= 1;
+    out_buf = out_bufs[out_push_i];
+    out_len = 0;
+    out_wait(1); // The other buffer has to be drained before it is reused
+}
+
+
+/**
+* Wait (VM side) until at most 'max_full' buffers are waiting to be written
+**/
+static void out_wait(const uint32_t max_full)
+{
+    if (__atomic_load_n(&out_full, __ATOMIC_SEQ_CST) <= max_full)
+    {
+        return;
+    }
+    pthread_mutex_lock(&out_lock);
+    __atomic_add_fetch(&out_sleeping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&out_full, __ATOMIC_SEQ_CST) > max_full)
+    {
+        pthread_cond_wait(&out_cond, &out_lock);
+    }
+    __atomic_sub_fetch(&out_sleeping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&out_lock);
+}
+
+
+/**
+* Wake up the other side if it is waiting, called after changing out_full or out_quit
+**/
+static void out_wake(void)
+{
+    if (__atomic_load_n(&out_sleeping, __ATOMIC_SEQ_CST) != 0)
+    {
+        pthread_mutex_lock(&out_lock);
+        pthread_cond_broadcast(&out_cond);
+        pthread_mutex_unlock(&out_lock);
+    }
+}
+
+
+/**
+* Body of the writer thread: write buffers in the order they were handed over until told to quit
+**/
+static void* out_thread(void* arg)
+{
+    uint32_t pop_i = 0;
+    (void)arg;
+
+    for (;;)
+    {
+        if (__atomic_load_n(&out_full, __ATOMIC_SEQ_CST) == 0)
+        {
+            pthread_mutex_lock(&out_lock);
+            __atomic_add_fetch(&out_sleeping, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&out_full, __ATOMIC_SEQ_CST) == 0 && !__atomic_load_n(&out_quit, __ATOMIC_SEQ_CST))
+            {
+                pthread_cond_wait(&out_cond, &out_lock);
+            }
+            __atomic_sub_fetch(&out_sleeping, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&out_lock);
+            if (__atomic_load_n(&out_full, __ATOMIC_SEQ_CST) == 0)
+            {
+                break; // Told to quit with nothing left to write
+            }
+        }
+        out_write(out_bufs[pop_i], out_lens[pop_i]);
+        pop_i ^= 1;
+        __atomic_sub_fetch(&out_full, 1, __ATOMIC_SEQ_CST);
+        out_wake();
+    }
+    return NULL;
+}
+
+
+/**
+* Start writing asynchronously if IJVM_ASYNC_OUTPUT is set and the output is not a terminal
+**/
+static void out_start(void)
+{
+    const char* async = getenv("IJVM_ASYNC_OUTPUT");
+
+    if (g_out_file == NULL || out_tty)
+    {
+        return;
+    }
+    if (ring_start() == true)
+    {
+        fflush(g_out_file); // Everything written through stdio goes first
+        out_push_i = 0;
+        out_buf = out_bufs[0];
+        out_ring = true;
+        return;
+    }
+    if (async == NULL || async[0] == '\0' || async[0] == '0')
+    {
+        return;
+    }
+    fflush(g_out_file); // Everything written through stdio goes first
+    out_push_i = 0;
+    out_buf = out_bufs[0];
+    out_full = 0;
+    out_quit = false;
+    out_async = true;
+    if (pthread_create(&out_writer, NULL, out_thread, NULL) != 0)
+    {
+        out_async = false; // Write synchronously then
+    }
+    dprintf("[ASYNC OUTPUT %d]\n", out_async);
+}
+
+
+/**
+* Write out everything, then stop and join the writer thread (or stop using io_uring)
+**/
+static void out_stop(void)
+{
+    if (out_ring == true)
+    {
+        io_flush();
+        out_ring = false;
+        out_push_i = 0;
+        out_buf = out_bufs[0];
+        return;
+    }
+    if (out_async != true)
+    {
+        return;
+    }
+    io_flush();
+    __atomic_store_n(&out_quit, true, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&out_lock);
+    pthread_cond_broadcast(&out_cond);
+    pthread_mutex_unlock(&out_lock);
+    pthread_join(out_writer, NULL);
+    out_async = false;
+    out_buf = out_bufs[0];
+}
+
+
+/**
+* Register the input and output buffers with io_uring the first time it is used
+* Return  true if input and output can be done with io_uring
+**/
+static bool ring_start(void)
+{
+    struct iovec iovs[4];
+
+    if (ring_registered == true)
+    {
+        return true;
+    }
+    if (uring_enabled() != true)
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        iovs[i].iov_base = out_bufs[i];
+        iovs[i].iov_len = IO_OUT_BUFFER_SIZE;
+        iovs[2 + i].iov_base = in_bufs[i];
+        iovs[2 + i].iov_len = IO_IN_BUFFER_SIZE;
+    }
+    if (uring_register_buffers(iovs, 4) != true)
+    {
+        return false;
+    }
+    uring_set_handler(URING_IO, ring_handle);
+    ring_registered = true;
+    return true;
+}
+
+
+/**
+* Handle the completion of a write or read request
+**/
+static void ring_handle(const struct io_uring_cqe* cqe)
+{
+    if (uring_data_op(cqe->user_data) == RING_OUT)
+    {
+        if (cqe->res == -EAGAIN || cqe->res == -EINTR)
+        {
+            out_ring_write(out_write_i, out_write_done);
+            return;
+        }
+        if (cqe->res <= 0)
+        {
+            fprintf(stderr, "[ERR] Failed to write output. In \"io.c::ring_handle\".\n");
+            out_writing = false;
+            return;
+        }
+        out_write_done += (uint32_t)cqe->res;
+        if (out_write_done < out_lens[out_write_i])
+        {
+            out_ring_write(out_write_i, out_write_done); // Short write
+            return;
+        }
+        out_writing = false;
+        return;
+    }
+
+    if (cqe->res == -EAGAIN)
+    {
+        in_ring_read();
+        return;
+    }
+    in_read_len = cqe->res; // Errors (and cancellations) end the input like they do for read
+    in_reading = false;
+    if (in_file != NULL)
+    {
+        thread_wake(fileno(in_file));
+    }
+}
+
+
+/**
+* Make a request writing the rest of an output buffer after 'done' bytes
+**/
+static void out_ring_write(const uint32_t buf_i, const uint32_t done)
+{
+    struct io_uring_sqe* sqe = uring_sqe(uring_data(URING_IO, RING_OUT, NULL));
+
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = fileno(g_out_file);
+    sqe->addr = (uint64_t)(uintptr_t)&out_bufs[buf_i][done];
+    sqe->len = out_lens[buf_i] - done;
+    sqe->off = (uint64_t)-1; // At the file position
+    sqe->buf_index = (uint16_t)buf_i;
+    out_writing = true;
+    out_write_i = buf_i;
+    out_write_done = done;
+    uring_submit(); // Along with anything else that is queued
+}
+
+
+/**
+* Wait until the last write request completed
+**/
+static void out_ring_wait(void)
+{
+    while (out_writing == true)
+    {
+        uring_wait(-1);
+    }
+}
+
+
+/**
+* Make a request reading as much input as is available into the next input buffer
+**/
+static void in_ring_read(void)
+{
+    struct io_uring_sqe* sqe = uring_sqe(uring_data(URING_IO, RING_IN, NULL));
+
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fileno(in_file);
+    sqe->addr = (uint64_t)(uintptr_t)in_bufs[in_read_i];
+    sqe->len = IO_IN_BUFFER_SIZE;
+    sqe->off = (uint64_t)-1; // At the file position
+    sqe->buf_index = (uint16_t)(2 + in_read_i);
+    in_reading = true;
+    in_read_made = true;
+    uring_submit();
+}
+
+
+/**
+* io_refill with io_uring: take the input of the read request under way (the first time it is
+* made here) and make the next one.
+* Return  next input byte
+*         EOF if there is no input left
+**/
+static int32_t in_ring_refill(void)
+{
+    if (in_read_made != true)
+    {
+        in_ring_read();
+    }
+    while (in_reading == true)
+    {
+        uring_wait(-1);
+    }
+    if (in_read_len <= 0)
+    {
+        in_eof = true;
+        return EOF;
+    }
+    g_in_pos = in_bufs[in_read_i];
+    g_in_end = &in_bufs[in_read_i][in_read_len];
+    in_read_made = false;
+    in_read_i ^= 1;
+    in_ring_read(); // Read ahead into the other buffer while this one is consumed
+    return *g_in_pos++;
+}
+
+
+void io_set_output(FILE* f)
+{
+    out_stop();
+    io_flush();
+    g_out_file = f;
+    out_tty = f != NULL && isatty(fileno(f)) == 1;
+    out_start();
+}
+
+
+void io_put(const byte_t c)
+{
+    out_buf[out_len++] = c;
+    if (out_len == IO_OUT_BUFFER_SIZE)
+    {
+        out_push();
+    }
+    else if (out_tty && c == '\n')
+    {
+        io_flush();
+    }
+}
+
+
+void io_write(const byte_t* src, const uint32_t len)
+{
+    uint32_t num;
+
+    if (out_async != true && out_ring != true && len >= IO_OUT_BUFFER_SIZE)
+    {
+        io_flush();
+        out_write(src, len); // Would only pass through the buffer
+        return;
+    }
+    for (uint32_t done = 0; done < len; done += num)
+    {
+        num = len - done < IO_OUT_BUFFER_SIZE - out_len ? len - done : IO_OUT_BUFFER_SIZE - out_len;
+        memcpy(&out_buf[out_len], &src[done], num);
+        out_len += num;
+        if (out_len == IO_OUT_BUFFER_SIZE)
+        {
+            out_push();
+        }
+    }
+    if (out_tty && memchr(src, '\n', len) != NULL)
+    {
+        io_flush();
+    }
+}
+
+
+void io_flush(void)
+{
+    if (out_len != 0)
+    {
+        out_push();
+    }
+    if (out_async)
+    {
+        out_wait(0); // Everything handed over has been written
+    }
+    else if (out_ring)
+    {
+        out_ring_wait();
+    }
+}
+
+
+void io_set_input(FILE* f)
+{
+    in_close();
+    in_file = f;
+    g_in_file = f;
+}
+
+
+int32_t io_refill(void)
+{
+    ssize_t num_read;
+
+    if (in_file == NULL)
+    {
+        return EOF;
+    }
+    if (in_opened != true)
+    {
+        in_open();
+        if (g_in_pos < g_in_end)
+        {
+            return *g_in_pos++;
+        }
+    }
+    if (in_eof || in_map != NULL)
+    {
+        return EOF;
+    }
+
+    if (out_tty)
+    {
+        io_flush(); // Show prompts before waiting for input
+    }
+    if (in_ring == true)
+    {
+        return in_ring_refill();
+    }
+    do
+    {
+        num_read = read(fileno(in_file), in_buf, IO_IN_BUFFER_SIZE);
+    }
+    while (num_read < 0 && errno == EINTR);
+    if (num_read <= 0)
+    {
+        in_eof = true;
+        return EOF;
+    }
+    g_in_pos = in_buf;
+    g_in_end = &in_buf[num_read];
+    return *g_in_pos++;
+}
+
+
+int io_wait_fd(uint32_t* events)
+{
+    struct pollfd pfd;
+
+    *events = EPOLLIN;
+    if (g_in_pos < g_in_end || in_file == NULL)
+    {
+        return -1;
+    }
+    if (in_opened != true)
+    {
+        in_open();
+        if (g_in_pos < g_in_end)
+        {
+            return -1;
+        }
+    }
+    if (in_eof || in_map != NULL)
+    {
+        return -1;
+    }
+
+    if (out_tty)
+    {
+        io_flush(); // Show prompts before waiting for input
+    }
+    if (in_ring == true)
+    {
+        if (in_read_made != true)
+        {
+            in_ring_read();
+        }
+        uring_reap();
+        *events = 0; // Woken by the completion
+        return in_reading == true ? fileno(in_file) : -1;
+    }
+    pfd.fd = fileno(in_file);
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) == 0 ? pfd.fd : -1;
+}
+
+
+uint32_t io_read(byte_t* dst, const uint32_t max)
+{
+    uint32_t num;
+    int32_t c;
+
+    if (max == 0)
+    {
+        return 0;
+    }
+    if (g_in_pos >= g_in_end)
+    {
+        c = io_refill(); // Waits for more input
+        if (c == EOF)
+        {
+            return 0;
+        }
+        g_in_pos--; // Give the byte back, it is copied with the rest
+    }
+    num = (size_t)(g_in_end - g_in_pos) < max ? (uint32_t)(g_in_end - g_in_pos) : max;
+    memcpy(dst, g_in_pos, num);
+    g_in_pos += num;
+    return num;
+}
+
+
+word_t io_map_input(void)
+{
+    word_t arr_ref;
+    const byte_t* head;
+    size_t head_len;
+    byte_t* joined = NULL;
+
+    if (in_file == NULL)
+    {
+        return 0;
+    }
+    if (in_opened != true)
+    {
+        in_open();
+    }
+    if (in_map != NULL)
+    {
+        arr_ref = arr_create_file(fileno(in_file), (off_t)(g_in_pos - in_map), NULL, 0);
+    }
+    else if (in_eof)
+    {
+        arr_ref = 0;
+    }
+    else
+    {
+        head = g_in_pos;
+        head_len = g_in_pos == NULL ? 0 : (size_t)(g_in_end - g_in_pos);
+        while (in_reading == true)
+        {
+            uring_wait(-1);
+        }
+        if (in_ring == true && in_read_len > 0)
+        {
+            // Input read ahead follows what is left in the buffer
+            joined = (byte_t*)malloc(head_len + (size_t)in_read_len);
+            if (joined == NULL)
+            {
+                fprintf(stderr, "[ERR] Failed to allocate memory. In \"io.c::io_map_input\".\n");
+                destroy_ijvm_now();
+                return 0;
+            }
+            memcpy(joined, head, head_len);
+            memcpy(&joined[head_len], in_bufs[in_read_i], (size_t)in_read_len);
+            head = joined;
+            head_len += (size_t)in_read_len;
+            in_read_len = 0;
+            in_read_made = false;
+        }
+        arr_ref = arr_create_file(fileno(in_file), -1, head, head_len);
+        free(joined);
+    }
+    g_in_pos = g_in_end;
+    in_eof = true;
+    return arr_ref;
+}
+
+
+void io_destroy(void)
+{
+    out_stop();
+    io_flush();
+    out_len = 0;
+    in_close();
+    in_file = NULL;
+    ring_registered = false; // Buffers are unregistered with the ring
+}
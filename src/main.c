@@ -48,7 +48,7 @@ int main(int argc, char** argv)
 
     if (argc >= 3)
     {
-        FILE* in_file = fopen(argv[2], "r");
+        FILE* in_file = fopen(argv[2], "rb");
         if (in_file == NULL)
         {
             fprintf(stderr, "[ERR] Failed to open %s. In \"main.c::main\".\n", argv[2]);
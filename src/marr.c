@@ -3,37 +3,34 @@
 
 // Declarations of static functions
 static uint32_t get_free_index(const MArr_t* marr);
-
-static uint32_t element_creations = 0;
+static void stack_free_indices(MArr_t* marr);
 
 
 /**
-* Find an unclaimed index in the mapped array and return it.
+* Find an unclaimed index in the mapped array and return it (the top of the free index stack).
 * Return  index on sucess
 *         SIZE_MAX_UINT32_T on failure
 * SIZE_MAX_UINT32_T is used as a special value because there will never be this many elements.
 **/
 static uint32_t get_free_index(const MArr_t* marr)
 {
-    uint32_t free_i = SIZE_MAX_UINT32_T;
-    if (element_creations >= 100)
-    {
-        element_creations = 0;
-        arr_gc();
-    }
-    else
-    {
-        element_creations++;
-    }
-    for (uint32_t map_ptr = 0; map_ptr < marr->size; map_ptr++)
+    return marr->num_free > 0 ? marr->free_indices[marr->num_free - 1] : SIZE_MAX_UINT32_T;
+}
+
+
+/**
+* Rebuild the free index stack from the map so the lowest unclaimed index is claimed first
+**/
+static void stack_free_indices(MArr_t* marr)
+{
+    marr->num_free = 0;
+    for (uint32_t val_i = marr->size; val_i-- > 0;)
     {
-        if (marr->map[map_ptr] == false)
+        if (marr->map[val_i] == false)
         {
-            free_i = map_ptr;
-            break;
+            marr->free_indices[marr->num_free++] = val_i;
         }
     }
-    return free_i;
 }
 
 
@@ -41,6 +38,11 @@ void marr_init(MArr_t* marr, const uint32_t size)
 {
     marr->map = NULL;
     marr->values = NULL;
+    marr->live = NULL;
+    marr->live_pos = NULL;
+    marr->num_live = 0;
+    marr->free_indices = NULL;
+    marr->num_free = 0;
     marr->size = 0;
     if (size == 0)
     {
@@ -53,13 +55,16 @@ void marr_init(MArr_t* marr, const uint32_t size)
 
 void marr_resize(MArr_t* marr, const uint32_t new_size)
 {
-    uint32_t tmp_new_size = new_size;
     MArr_t tmp_marr = *marr;
+    const uint32_t num_kept = new_size < marr->size ? new_size : marr->size;
 
-    if (new_size < marr->size)
+    for (uint32_t live_i = 0; live_i < marr->num_live; live_i++)
     {
-        fprintf(stderr, "[ERR] New size cannot be less than the old size. In \"marr.c::marr_resize\".\n");
-        destroy_ijvm_now();
+        if (marr->live[live_i] >= new_size)
+        {
+            fprintf(stderr, "[ERR] New size would remove claimed elements. In \"marr.c::marr_resize\".\n");
+            destroy_ijvm_now();
+        }
     }
     if (new_size >= SIZE_MAX_UINT32_T)
     {
@@ -67,17 +72,29 @@ void marr_resize(MArr_t* marr, const uint32_t new_size)
         destroy_ijvm_now();
     }
 
-    marr->map = (bool*)calloc(tmp_new_size, sizeof(bool));
-    tmp_new_size = new_size;
-    marr->values = (uintptr_t*)calloc(tmp_new_size, sizeof(uintptr_t));
-    if (marr->map == NULL || marr->values == NULL)
+    marr->map = (bool*)calloc(new_size, sizeof(bool));
+    marr->values = (uintptr_t*)calloc(new_size, sizeof(uintptr_t));
+    marr->live = (uint32_t*)malloc(new_size * sizeof(uint32_t));
+    marr->live_pos = (uint32_t*)malloc(new_size * sizeof(uint32_t));
+    marr->free_indices = (uint32_t*)malloc(new_size * sizeof(uint32_t));
+    if (marr->map == NULL || marr->values == NULL || marr->live == NULL || marr->live_pos == NULL ||
+        marr->free_indices == NULL)
     {
+        free(marr->map);
+        free(marr->values);
+        free(marr->live);
+        free(marr->live_pos);
+        free(marr->free_indices);
         *marr = tmp_marr;
-        if (arr_gc() != 0)
+        if (new_size > marr->size && arr_gc() != 0)
         {
             marr_resize(marr, new_size); // Run GC to be sure memory allocation error is not caused by garbage
             return;
         }
+        if (new_size < marr->size)
+        {
+            return; // Keep the old (larger) memory
+        }
         fprintf(stderr, "[ERR] Failed to allocate memory. In \"marr.c::marr_resize\".\n");
         destroy_ijvm_now();
     }
@@ -85,13 +102,36 @@ void marr_resize(MArr_t* marr, const uint32_t new_size)
     marr->size = new_size;
     if (tmp_marr.map != NULL)
     {
-        memcpy(marr->map, tmp_marr.map, tmp_marr.size * sizeof(bool));
+        memcpy(marr->map, tmp_marr.map, num_kept * sizeof(bool));
+        memcpy(marr->values, tmp_marr.values, num_kept * sizeof(uintptr_t));
+        memcpy(marr->live, tmp_marr.live, tmp_marr.num_live * sizeof(uint32_t));
+        memcpy(marr->live_pos, tmp_marr.live_pos, num_kept * sizeof(uint32_t));
+    }
+    stack_free_indices(marr);
+    marr_destroy(&tmp_marr);
+}
+
+
+void marr_shrink(MArr_t* marr, const uint32_t min_size)
+{
+    uint32_t end = 0; // One past the highest claimed index
+    uint32_t new_size = marr->size;
+
+    for (uint32_t live_i = 0; live_i < marr->num_live; live_i++)
+    {
+        if (marr->live[live_i] >= end)
+        {
+            end = marr->live[live_i] + 1;
+        }
     }
-    if (tmp_marr.values != NULL)
+    while (new_size / 2 >= min_size && end <= new_size / 4)
     {
-        memcpy(marr->values, tmp_marr.values, tmp_marr.size * sizeof(uintptr_t));
+        new_size /= 2;
+    }
+    if (new_size < marr->size)
+    {
+        marr_resize(marr, new_size);
     }
-    marr_destroy(&tmp_marr);
 }
 
 
@@ -106,7 +146,7 @@ bool marr_check_marked(const MArr_t* marr, const uint32_t val_i)
 }
 
 
-uint32_t marr_add_element(const MArr_t* marr, const uintptr_t data)
+uint32_t marr_add_element(MArr_t* marr, const uintptr_t data)
 {
     const uint32_t free_i = get_free_index(marr);
     if (free_i == SIZE_MAX_UINT32_T)
@@ -114,13 +154,12 @@ uint32_t marr_add_element(const MArr_t* marr, const uintptr_t data)
         return free_i;
     }
 
-    marr->values[free_i] = data;
-    marr->map[free_i] = true;
+    marr_set_element(marr, free_i, data);
     return free_i;
 }
 
 
-void marr_set_element(const MArr_t* marr, const uint32_t val_i, const uintptr_t data)
+void marr_set_element(MArr_t* marr, const uint32_t val_i, const uintptr_t data)
 {
     if (val_i >= marr->size)
     {
@@ -128,6 +167,21 @@ void marr_set_element(const MArr_t* marr, const uint32_t val_i, const uintptr_t
         destroy_ijvm_now();
     }
 
+    if (marr->map[val_i] != true)
+    {
+        marr->live_pos[val_i] = marr->num_live;
+        marr->live[marr->num_live++] = val_i;
+
+        // Take the index off the free index stack (marr_add_element claims the one on top)
+        for (uint32_t free_i = marr->num_free; free_i-- > 0;)
+        {
+            if (marr->free_indices[free_i] == val_i)
+            {
+                marr->free_indices[free_i] = marr->free_indices[--marr->num_free];
+                break;
+            }
+        }
+    }
     marr->values[val_i] = data;
     marr->map[val_i] = true;
 }
@@ -149,14 +203,24 @@ uintptr_t marr_get_element(const MArr_t* marr, const uint32_t val_i)
 }
 
 
-void marr_remove_element(const MArr_t* marr, const uint32_t val_i)
+void marr_remove_element(MArr_t* marr, const uint32_t val_i)
 {
+    uint32_t last_i;
+
     if (val_i >= marr->size)
     {
         fprintf(stderr, "[ERR] Tried to remove a non existent element from a mapped array. In \"marr.c::marr_remove_element\".\n");
         destroy_ijvm_now();
     }
 
+    if (marr->map[val_i] == true)
+    {
+        // Move the last claimed index into the hole
+        last_i = marr->live[--marr->num_live];
+        marr->live[marr->live_pos[val_i]] = last_i;
+        marr->live_pos[last_i] = marr->live_pos[val_i];
+        marr->free_indices[marr->num_free++] = val_i;
+    }
     marr->values[val_i] = 0;
     marr->map[val_i] = false;
 }
@@ -166,10 +230,18 @@ void marr_destroy(MArr_t* marr)
 {
     free(marr->map);
     free(marr->values);
+    free(marr->live);
+    free(marr->live_pos);
+    free(marr->free_indices);
 
     // Not necessary but eh...
     marr->map = NULL;
     marr->values = NULL;
+    marr->live = NULL;
+    marr->live_pos = NULL;
+    marr->num_live = 0;
+    marr->free_indices = NULL;
+    marr->num_free = 0;
     marr->size = 0;
 }
 
@@ -1,18 +1,71 @@
+#define _GNU_SOURCE // accept4
 #include "net.h"
 
 
 // Declarations of static functions
 static inline uint32_t ref_to_index(const word_t net_ref);
 static inline word_t index_to_ref(const uint32_t net_i);
+static Sock_t* sock_alloc(const int fd);
 static word_t socket_create(const uint32_t host, const uint16_t port);
 static void net_check_ref(const word_t net_ref);
-static word_t socket_store(const Sock_t* sock);
+static word_t socket_store(Sock_t* sock);
+static Sock_t* sock_get(const word_t net_ref);
+static int sock_conn_fd(const Sock_t* sock, const char* func);
+static bool sock_flush(Sock_t* sock);
+static void sock_reserve(Sock_t* sock, const uint32_t len);
+static void sock_watch(Sock_t* sock, const int op, const uint32_t events);
+static void sock_queue(Sock_t* sock);
+static void sock_pend(Sock_t* sock);
+static void sock_unpend(Sock_t* sock);
+static void sock_forget(Sock_t* sock);
+static void net_flush_pending(void);
+static int64_t net_now(void);
+static void sock_start(Sock_t* sock);
+static void sock_free(Sock_t* sock);
+static void sock_close(const word_t net_ref, const int64_t deadline);
+static bool ring_start(void);
+static void ring_arm(Sock_t* sock);
+static bool ring_send(Sock_t* sock);
+static void ring_send_rest(Sock_t* sock);
+static void ring_append(Sock_t* sock, const byte_t* data, const uint32_t len);
+static void ring_handle(const struct io_uring_cqe* cqe);
 
 
 static const uint32_t k_index_to_ref = 0xCC00000C;
 static const uint32_t k_ref_to_index = 0x00FFFFF0;
 
-static MArr_t net_conn = {0, NULL, NULL}; // Keep track of connections
+// Keep track of connections, indices are taken from and given back to a stack of free ones
+static Sock_t** net_socks = NULL; // Indexed by network index (NULL if the index is free)
+static uint32_t* net_free = NULL; // Released indices, reused last in first out
+static uint32_t net_num_free = 0;
+static uint32_t net_next_i = 0; // Indices from here on were never used
+static uint32_t net_cap = 0;
+
+static int net_epoll = -1; // Watches non-blocking sockets, created by the first one
+static uint32_t net_watched = 0; // Number of sockets watched by net_epoll
+
+// Sockets NETPOLL returns next (removed ones are NULL), emptied before waiting on epoll again
+static Sock_t** net_ready = NULL;
+static uint32_t net_ready_head = 0;
+static uint32_t net_ready_num = 0;
+static uint32_t net_ready_cap = 0;
+
+// Non-blocking connections with output NETPOLL has to send
+static Sock_t** net_pending = NULL;
+static uint32_t net_pending_num = 0;
+static uint32_t net_pending_cap = 0;
+
+/**
+* io_uring (IJVM_IO_URING): non-blocking sockets are watched by requests instead of epoll.
+* Listening sockets have a multishot poll request and connections a multishot receive request
+* taking buffers provided to the kernel (the data is appended to their receive buffer). Output is
+* handed to a send request as a whole while NETOUT appends to the other buffer. Requests are only
+* submitted once NETPOLL waits (or NETIN would block) so they are batched with all other IO.
+**/
+enum { RING_POLL, RING_RECV, RING_SEND };
+static int8_t net_ring_state = -1; // Not decided yet (-1), epoll (0), or io_uring (1)
+static bool net_ring_oneshot = false; // Kernel has no multishot requests, make one per completion
+static uint32_t net_ring_ops = 0; // Requests under way of all sockets
 
 
 /**
@@ -34,20 +87,59 @@ static inline word_t index_to_ref(const uint32_t net_i)
 
 
 /**
-* Create an IPv4 TCP socket and return it's network reference
+* Track a new socket using the given file descriptor.
+* Return  the socket (its network reference is stored in it)
 **/
-static word_t socket_create(const uint32_t host, const uint16_t port)
+static Sock_t* sock_alloc(const int fd)
 {
     Sock_t* sock = (Sock_t*)malloc(sizeof(Sock_t));
-    sock->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == NULL)
+    {
+        fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::sock_alloc\".\n");
+        destroy_ijvm_now();
+        return NULL;
+    }
+    sock->fd = fd;
     sock->fds = -1;
     sock->client = false;
     sock->server = false;
+    sock->addr_len = sizeof(sock->addr);
+    sock->recv_buf = NULL;
+    sock->recv_pos = 0;
+    sock->recv_len = 0;
+    sock->recv_cap = NET_BUFFER_SIZE;
+    sock->send_buf = NULL;
+    sock->send_len = 0;
+    sock->send_cap = NET_BUFFER_SIZE;
+    sock->listener = false;
+    sock->nonblock = false;
+    sock->queued = false;
+    sock->event = false;
+    sock->out_armed = false;
+    sock->pending_i = SIZE_MAX_UINT32_T;
+    sock->ring = false;
+    sock->closed = false;
+    sock->eof = false;
+    sock->ring_ops = 0;
+    sock->flight_buf = NULL;
+    sock->flight_cap = NET_BUFFER_SIZE;
+    sock->flight_len = 0;
+    sock->flight_done = 0;
+    sock->ref = socket_store(sock);
+    return sock;
+}
+
+
+/**
+* Create an IPv4 TCP socket and return it's network reference
+**/
+static word_t socket_create(const uint32_t host, const uint16_t port)
+{
+    Sock_t* sock = sock_alloc(socket(AF_INET, SOCK_STREAM, 0));
     sock->addr.sin_family = AF_INET;
     sock->addr.sin_port = htons(port);
     sock->addr.sin_addr.s_addr = htonl(host);
-    sock->addr_len = sizeof(sock->addr);
-    return socket_store(sock);
+    return sock->ref;
 }
 
 
@@ -58,7 +150,7 @@ static void net_check_ref(const word_t net_ref)
 {
     if ((((uint32_t)net_ref & 0xFF00000F) ^ k_index_to_ref) != 0)
     {
-        fprintf(stderr, "[ERR] Invalid network reference or program requires more connections than is possible. In \"net.c::net_check_ref\".\n");
+        fprintf(stderr, "[ERR] Invalid network reference. In \"net.c::net_check_ref\".\n");
         destroy_ijvm_now();
     }
 }
@@ -66,39 +158,50 @@ static void net_check_ref(const word_t net_ref)
 
 /**
 * Add the socket to network connections so it can be tracked/modified.
+* The table doubles when it is full, taking and releasing an index takes constant time.
 * Return  network reference of saved socket
 **/
-static word_t socket_store(const Sock_t* sock)
+static word_t socket_store(Sock_t* sock)
 {
+    Sock_t** tmp_socks;
+    uint32_t* tmp_free;
+    uint32_t new_cap = net_cap == 0 ? NET_CONN_MIN_NUM : net_cap * 2;
     uint32_t net_i;
-    word_t net_ref;
 
-    // Initialize if needed
-    if (net_conn.size == 0)
+    if (net_num_free == 0 && net_next_i == net_cap)
     {
-        marr_init(&net_conn, NET_CONN_MIN_NUM);
+        if (net_cap >= NET_CONN_MAX_NUM)
+        {
+            fprintf(stderr, "[ERR] Program requires more connections than is possible. In \"net.c::socket_store\".\n");
+            destroy_ijvm_now();
+        }
+        if (new_cap > NET_CONN_MAX_NUM)
+        {
+            new_cap = NET_CONN_MAX_NUM;
+        }
+        tmp_socks = (Sock_t**)realloc(net_socks, new_cap * sizeof(Sock_t*));
+        tmp_free = tmp_socks == NULL ? NULL : (uint32_t*)realloc(net_free, new_cap * sizeof(uint32_t));
+        if (tmp_socks == NULL || tmp_free == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::socket_store\".\n");
+            destroy_ijvm_now();
+        }
+        net_socks = tmp_socks;
+        net_free = tmp_free;
+        net_cap = new_cap;
     }
 
     // Save connection info
-    net_i = marr_add_element(&net_conn, (uintptr_t)sock);
-    if (net_i == SIZE_MAX_UINT32_T)
-    {
-        marr_resize(&net_conn, net_conn.size + 16);
-        net_i = marr_add_element(&net_conn, (uintptr_t)sock);
-    }
-
-    // Return network reference
-    net_ref = index_to_ref(net_i);
-    net_check_ref(net_ref);
-    return net_ref;
+    net_i = net_num_free > 0 ? net_free[--net_num_free] : net_next_i++;
+    net_socks[net_i] = sock;
+    return index_to_ref(net_i);
 }
 
 
 word_t net_bind(const word_t port)
 {
     const word_t net_ref = socket_create(INADDR_ANY, (uint16_t)port);
-    const uint32_t net_i = ref_to_index(net_ref);
-    Sock_t* sock = (Sock_t*)marr_get_element(&net_conn, net_i);
+    Sock_t* sock = sock_get(net_ref);
     
     int success = bind(sock->fd, (struct sockaddr*)&sock->addr, sock->addr_len);
     if (success == -1)
@@ -129,8 +232,7 @@ word_t net_bind(const word_t port)
 word_t net_connect(const word_t host, const word_t port)
 {
     const word_t net_ref = socket_create((uint32_t)host, (uint16_t)port);
-    const uint32_t net_i = ref_to_index(net_ref);
-    Sock_t* sock = (Sock_t*)marr_get_element(&net_conn, net_i);
+    Sock_t* sock = sock_get(net_ref);
 
     const int success = connect(sock->fd, (struct sockaddr*)&sock->addr, sock->addr_len);
     if (success == -1)
@@ -143,84 +245,990 @@ word_t net_connect(const word_t host, const word_t port)
 }
 
 
-char net_recv(const word_t net_ref)
+word_t net_listen(const word_t port)
 {
-    uint32_t net_i;
+    const word_t net_ref = socket_create(INADDR_ANY, (uint16_t)port);
+    Sock_t* sock = sock_get(net_ref);
+    const int reuse = 1;
+
+    // A restarted server should not have to wait for old connections to time out
+    setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (fcntl(sock->fd, F_SETFL, O_NONBLOCK) == -1 ||
+        bind(sock->fd, (struct sockaddr*)&sock->addr, sock->addr_len) == -1 ||
+        listen(sock->fd, NET_LISTEN_BACKLOG) == -1)
+    {
+        net_close(net_ref);
+        return 0; // Failed to listen on the port
+    }
+
+    sock->listener = true;
+    sock_start(sock);
+    return net_ref;
+}
+
+
+word_t net_accept(const word_t net_ref)
+{
+    Sock_t* sock = sock_get(net_ref);
+    Sock_t* conn;
+    int fd;
+
+    if (sock->listener == false)
+    {
+        fprintf(stderr, "[ERR] Socket is not listening. In \"net.c::net_accept\".\n");
+        destroy_ijvm_now();
+        return 0;
+    }
+    do
+    {
+        fd = accept4(sock->fd, NULL, NULL, SOCK_NONBLOCK);
+    }
+    while (fd == -1 && errno == EINTR);
+    if (fd == -1)
+    {
+        return 0; // No connection is waiting (or it was aborted already)
+    }
+
+    if (sock->ring == true)
+    {
+        // Poll requests only complete when a connection arrives, more may be waiting already
+        sock->event = true;
+        sock_queue(sock);
+    }
+    conn = sock_alloc(fd);
+    conn->client = true;
+    sock_start(conn);
+    return conn->ref;
+}
+
+
+word_t net_poll(const word_t timeout)
+{
+    static struct epoll_event events[NET_POLL_EVENTS];
+    const int64_t deadline = net_now() + timeout;
+    int32_t wait_time = timeout < 0 ? -1 : timeout;
     Sock_t* sock;
-    ssize_t bytes_recvd = 0;
-    char data_buffer = 0;
+    int num_events;
+
+    net_flush_pending();
+    while (true)
+    {
+        // Return queued sockets first so every ready socket gets its turn
+        while (net_ready_head < net_ready_num)
+        {
+            sock = net_ready[net_ready_head++];
+            if (sock == NULL)
+            {
+                continue; // Closed after it was queued
+            }
+            sock->queued = false;
+            if (sock->event == false && sock->recv_pos >= sock->recv_len)
+            {
+                continue; // Only queued for received bytes which NETIN took since
+            }
+            sock->event = false;
+            return sock->ref;
+        }
+        net_ready_head = 0;
+        net_ready_num = 0;
+        if (net_watched == 0)
+        {
+            return 0; // Nothing could ever become ready
+        }
+        if (timeout >= 0)
+        {
+            wait_time = deadline > net_now() ? (int32_t)(deadline - net_now()) : 0;
+        }
+
+        if (net_ring_state == 1)
+        {
+            uring_wait(wait_time); // Completions queue the sockets
+        }
+        else
+        {
+            do
+            {
+                num_events = epoll_wait(net_epoll, events, NET_POLL_EVENTS, wait_time);
+            }
+            while (num_events == -1 && errno == EINTR);
+            for (int i = 0; i < num_events; i++)
+            {
+                sock = (Sock_t*)events[i].data.ptr;
+                if ((events[i].events & EPOLLOUT) != 0 && sock->pending_i != SIZE_MAX_UINT32_T &&
+                    sock_flush(sock) == true)
+                {
+                    sock_unpend(sock);
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+                {
+                    sock->event = true;
+                    sock_queue(sock);
+                }
+            }
+        }
+        if (net_ready_head == net_ready_num && timeout >= 0 && net_now() >= deadline)
+        {
+            return 0; // Timed out
+        }
+    }
+}
+
+
+/**
+* Return the socket behind a network reference
+**/
+static Sock_t* sock_get(const word_t net_ref)
+{
+    const uint32_t net_i = ref_to_index(net_ref);
 
     net_check_ref(net_ref);
-    net_i = ref_to_index(net_ref);
-    sock = (Sock_t*)marr_get_element(&net_conn, net_i);
+    if (net_i >= net_next_i || net_socks[net_i] == NULL)
+    {
+        fprintf(stderr, "[ERR] Network reference to a closed connection. In \"net.c::sock_get\".\n");
+        destroy_ijvm_now();
+    }
+    return net_socks[net_i];
+}
+
 
-    // Receive data
+/**
+* Return the file descriptor data of a connection goes through
+**/
+static int sock_conn_fd(const Sock_t* sock, const char* func)
+{
     if (sock->client == true && sock->server == false)
     {
-        bytes_recvd = recv(sock->fd, &data_buffer, 1, 0);
+        return sock->fd;
     }
-    else if (sock->client == false && sock->server == true)
+    if (sock->client == false && sock->server == true)
     {
-        bytes_recvd = recv(sock->fds, &data_buffer, 1, 0);
+        return sock->fds;
+    }
+    if (sock->client == true && sock->server == true)
+    {
+        fprintf(stderr, "[ERR] Socket cannot be both connected and bound. In \"net.c::%s\".\n", func);
     }
     else
     {
-        fprintf(stderr, "[ERR] Socket cannot be both connected and bound. In \"net.c::net_recv\".\n");
-        destroy_ijvm_now();
+        fprintf(stderr, "[ERR] Socket is not connected. In \"net.c::%s\".\n", func);
     }
+    destroy_ijvm_now();
+    return -1;
+}
 
-    // Verify read
-    if (bytes_recvd != 1)
+
+/**
+* Send everything in the send buffer of a socket. A non-blocking connection sends what the peer
+* takes and keeps the rest, its output is dropped if the connection failed (NETIN reports it).
+* Return  true if the send buffer is empty
+**/
+static bool sock_flush(Sock_t* sock)
+{
+    uint32_t done = 0;
+    ssize_t bytes_sent;
+    int fd;
+
+    if (sock->ring == true)
     {
-        fprintf(stderr, "[ERR] Received unexpected number of bytes. In \"net.c::net_recv\".\n");
+        return ring_send(sock);
+    }
+    if (sock->send_len == 0)
+    {
+        return true;
+    }
+    fd = sock_conn_fd(sock, "net_send");
+    while (done < sock->send_len)
+    {
+        bytes_sent = send(fd, &sock->send_buf[done], sock->send_len - done, MSG_NOSIGNAL);
+        if (bytes_sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_sent < 0 && sock->nonblock == true && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            memmove(sock->send_buf, &sock->send_buf[done], sock->send_len - done);
+            sock->send_len -= done;
+            return false;
+        }
+        if (bytes_sent <= 0)
+        {
+            sock->send_len = 0; // Do not try again when closing
+            if (sock->nonblock == true)
+            {
+                return true;
+            }
+            fprintf(stderr, "[ERR] Sent unexpected number of bytes. In \"net.c::net_send\".\n");
+            destroy_ijvm_now();
+        }
+        done += (uint32_t)bytes_sent;
+    }
+    sock->send_len = 0;
+    return true;
+}
+
+
+/**
+* Add a non-blocking socket to epoll or change the events it is watched for
+**/
+static void sock_watch(Sock_t* sock, const int op, const uint32_t events)
+{
+    struct epoll_event event;
+
+    if (net_epoll == -1)
+    {
+        net_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (net_epoll == -1)
+        {
+            fprintf(stderr, "[ERR] Failed to create an epoll instance. In \"net.c::sock_watch\".\n");
+            destroy_ijvm_now();
+        }
+    }
+    event.events = events;
+    event.data.ptr = sock;
+    if (epoll_ctl(net_epoll, op, sock->fd, &event) == -1)
+    {
+        fprintf(stderr, "[ERR] Failed to watch a socket. In \"net.c::sock_watch\".\n");
         destroy_ijvm_now();
     }
-    return data_buffer;
+    if (op == EPOLL_CTL_ADD)
+    {
+        net_watched++;
+    }
 }
 
 
-void net_send(const word_t net_ref, const word_t data)
+/**
+* Append a socket to the sockets NETPOLL returns (unless it is there already)
+**/
+static void sock_queue(Sock_t* sock)
+{
+    Sock_t** new_ready;
+
+    if (sock->queued == true)
+    {
+        return;
+    }
+    if (net_ready_num == net_ready_cap)
+    {
+        net_ready_cap = net_ready_cap == 0 ? NET_POLL_EVENTS : net_ready_cap * 2;
+        new_ready = (Sock_t**)realloc(net_ready, net_ready_cap * sizeof(Sock_t*));
+        if (new_ready == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::sock_queue\".\n");
+            destroy_ijvm_now();
+            return;
+        }
+        net_ready = new_ready;
+    }
+    net_ready[net_ready_num++] = sock;
+    sock->queued = true;
+}
+
+
+/**
+* Remember that a non-blocking connection has output to send (unless it is remembered already)
+**/
+static void sock_pend(Sock_t* sock)
+{
+    Sock_t** new_pending;
+
+    if (sock->pending_i != SIZE_MAX_UINT32_T)
+    {
+        return;
+    }
+    if (net_pending_num == net_pending_cap)
+    {
+        net_pending_cap = net_pending_cap == 0 ? NET_POLL_EVENTS : net_pending_cap * 2;
+        new_pending = (Sock_t**)realloc(net_pending, net_pending_cap * sizeof(Sock_t*));
+        if (new_pending == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::sock_pend\".\n");
+            destroy_ijvm_now();
+            return;
+        }
+        net_pending = new_pending;
+    }
+    sock->pending_i = net_pending_num;
+    net_pending[net_pending_num++] = sock;
+}
+
+
+/**
+* Forget that a non-blocking connection has output to send and stop waiting for it to be writable
+**/
+static void sock_unpend(Sock_t* sock)
+{
+    Sock_t* last = net_pending[--net_pending_num];
+
+    // Move the last connection into the freed slot
+    net_pending[sock->pending_i] = last;
+    last->pending_i = sock->pending_i;
+    sock->pending_i = SIZE_MAX_UINT32_T;
+    if (sock->out_armed == true)
+    {
+        sock_watch(sock, EPOLL_CTL_MOD, EPOLLIN);
+        sock->out_armed = false;
+    }
+}
+
+
+/**
+* Remove every reference to a socket that is about to be closed
+**/
+static void sock_forget(Sock_t* sock)
+{
+    struct io_uring_sqe* sqe;
+
+    if (sock->nonblock == false)
+    {
+        return;
+    }
+    if (sock->pending_i != SIZE_MAX_UINT32_T)
+    {
+        sock->out_armed = false; // Removed from epoll below
+        sock_unpend(sock);
+    }
+    if (sock->queued == true)
+    {
+        for (uint32_t i = net_ready_head; i < net_ready_num; i++)
+        {
+            if (net_ready[i] == sock)
+            {
+                net_ready[i] = NULL;
+            }
+        }
+    }
+    if (sock->ring == true && sock->ring_ops != 0)
+    {
+        sqe = uring_sqe(uring_data(URING_IGNORE, 0, NULL));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = uring_data(URING_NET, sock->listener ? RING_POLL : RING_RECV, sock);
+    }
+    else if (sock->ring == false)
+    {
+        epoll_ctl(net_epoll, EPOLL_CTL_DEL, sock->fd, NULL);
+    }
+    net_watched--;
+}
+
+
+/**
+* Send as much pending output of non-blocking connections as their peers take. Connections
+* that still have output are watched for becoming writable.
+**/
+static void net_flush_pending(void)
 {
-    uint32_t net_i;
     Sock_t* sock;
-    ssize_t bytes_sent = 0;
 
-    net_check_ref(net_ref);
-    net_i = ref_to_index(net_ref);
-    sock = (Sock_t*)marr_get_element(&net_conn, net_i);
+    for (uint32_t i = net_pending_num; i-- > 0;)
+    {
+        sock = net_pending[i];
+        if (sock_flush(sock) == true)
+        {
+            sock_unpend(sock);
+        }
+        else if (sock->ring == false && sock->out_armed == false)
+        {
+            sock_watch(sock, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+            sock->out_armed = true;
+        }
+    }
+}
 
-    //Send data
-    if (sock->client == true && sock->server == false)
+
+/**
+* Return  milliseconds since some fixed point in time
+**/
+static int64_t net_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/**
+* Make a socket non-blocking and start watching it for NETPOLL (with io_uring if enabled)
+**/
+static void sock_start(Sock_t* sock)
+{
+    sock->nonblock = true;
+    if (ring_start() == true)
     {
-        bytes_sent = send(sock->fd, &data, 4, 0);
+        sock->ring = true;
+        net_watched++;
+        ring_arm(sock);
     }
-    else if (sock->client == false && sock->server == true)
+    else
     {
-        bytes_sent = send(sock->fds, &data, 4, 0);
+        sock_watch(sock, EPOLL_CTL_ADD, EPOLLIN);
+    }
+}
+
+
+/**
+* Free a socket and its buffers
+**/
+static void sock_free(Sock_t* sock)
+{
+    free(sock->recv_buf);
+    free(sock->send_buf);
+    free(sock->flight_buf);
+    free(sock);
+}
+
+
+/**
+* Decide whether non-blocking sockets are served by io_uring (the first time one is created)
+* Return  true if they are
+**/
+static bool ring_start(void)
+{
+    if (net_ring_state == -1)
+    {
+        net_ring_state = uring_enabled() == true && uring_provide_buffers() == true ? 1 : 0;
+        if (net_ring_state == 1)
+        {
+            uring_set_handler(URING_NET, ring_handle);
+        }
+    }
+    return net_ring_state == 1;
+}
+
+
+/**
+* Make the request watching a socket: a poll request for a listening socket and a receive
+* request for a connection
+**/
+static void ring_arm(Sock_t* sock)
+{
+    struct io_uring_sqe* sqe;
+
+    if (sock->listener == true)
+    {
+        sqe = uring_sqe(uring_data(URING_NET, RING_POLL, sock));
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+        sqe->len = net_ring_oneshot ? 0 : IORING_POLL_ADD_MULTI;
     }
     else
     {
-        fprintf(stderr, "[ERR] Socket cannot be both connected and bound. In \"net.c::net_send\".\n");
-        destroy_ijvm_now();
+        sqe = uring_sqe(uring_data(URING_NET, RING_RECV, sock));
+        sqe->opcode = IORING_OP_RECV;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->ioprio = net_ring_oneshot ? 0 : IORING_RECV_MULTISHOT;
+    }
+    sqe->fd = sock->fd;
+    sock->ring_ops++;
+    net_ring_ops++;
+}
+
+
+/**
+* sock_flush with io_uring: hand the send buffer to a send request unless one is under way
+* Return  true if all output was sent
+**/
+static bool ring_send(Sock_t* sock)
+{
+    byte_t* buf = sock->flight_buf;
+    const uint32_t cap = sock->flight_cap;
+
+    if (sock->flight_len == 0 && sock->send_len != 0)
+    {
+        // Swap the buffers, NETOUT fills the other one meanwhile
+        sock->flight_buf = sock->send_buf;
+        sock->flight_cap = sock->send_cap;
+        sock->flight_len = sock->send_len;
+        sock->flight_done = 0;
+        sock->send_buf = buf;
+        sock->send_cap = cap;
+        sock->send_len = 0;
+        ring_send_rest(sock);
+    }
+    return sock->flight_len == 0 && sock->send_len == 0;
+}
+
+
+/**
+* Make a send request for the part of the handed over output that was not sent yet
+**/
+static void ring_send_rest(Sock_t* sock)
+{
+    struct io_uring_sqe* sqe = uring_sqe(uring_data(URING_NET, RING_SEND, sock));
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sock->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&sock->flight_buf[sock->flight_done];
+    sqe->len = sock->flight_len - sock->flight_done;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sock->ring_ops++;
+    net_ring_ops++;
+}
+
+
+/**
+* Append received bytes to the receive buffer of a connection, which grows if needed
+**/
+static void ring_append(Sock_t* sock, const byte_t* data, const uint32_t len)
+{
+    byte_t* new_buf;
+
+    if (sock->recv_buf == NULL)
+    {
+        sock->recv_buf = (byte_t*)malloc(sock->recv_cap);
+        if (sock->recv_buf == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::ring_append\".\n");
+            destroy_ijvm_now();
+        }
+    }
+    if (sock->recv_len + len > sock->recv_cap && sock->recv_pos != 0)
+    {
+        // Move the bytes NETIN did not take yet to the front
+        memmove(sock->recv_buf, &sock->recv_buf[sock->recv_pos], sock->recv_len - sock->recv_pos);
+        sock->recv_len -= sock->recv_pos;
+        sock->recv_pos = 0;
+    }
+    while (sock->recv_len + len > sock->recv_cap)
+    {
+        new_buf = (byte_t*)realloc(sock->recv_buf, (size_t)sock->recv_cap * 2);
+        if (new_buf == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::ring_append\".\n");
+            destroy_ijvm_now();
+        }
+        sock->recv_buf = new_buf;
+        sock->recv_cap *= 2;
+    }
+    memcpy(&sock->recv_buf[sock->recv_len], data, len);
+    sock->recv_len += len;
+}
+
+
+/**
+* Handle the completion of a request of a socket
+**/
+static void ring_handle(const struct io_uring_cqe* cqe)
+{
+    Sock_t* sock = (Sock_t*)uring_data_ptr(cqe->user_data);
+    const uint8_t op = uring_data_op(cqe->user_data);
+    const bool more = (cqe->flags & IORING_CQE_F_MORE) != 0; // Multishot request goes on
+    uint16_t buf_id;
+
+    if (more == false)
+    {
+        sock->ring_ops--;
+        net_ring_ops--;
+    }
+    if ((cqe->flags & IORING_CQE_F_BUFFER) != 0)
+    {
+        buf_id = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (sock->closed == false && cqe->res > 0)
+        {
+            ring_append(sock, uring_buffer(buf_id), (uint32_t)cqe->res);
+        }
+        uring_recycle(buf_id);
+    }
+    if (sock->closed == true)
+    {
+        if (sock->ring_ops == 0)
+        {
+            sock_free(sock);
+        }
+        return;
     }
 
+    if (op == RING_SEND)
+    {
+        if (cqe->res == -EAGAIN || cqe->res == -EINTR)
+        {
+            ring_send_rest(sock);
+            return;
+        }
+        if (cqe->res <= 0)
+        {
+            // Peer is gone, NETIN reports it
+            sock->flight_len = 0;
+            sock->send_len = 0;
+        }
+        else
+        {
+            sock->flight_done += (uint32_t)cqe->res;
+            if (sock->flight_done < sock->flight_len)
+            {
+                ring_send_rest(sock); // Short send
+                return;
+            }
+            sock->flight_len = 0;
+        }
+        if (ring_send(sock) == true && sock->pending_i != SIZE_MAX_UINT32_T)
+        {
+            sock_unpend(sock);
+        }
+        return;
+    }
+
+    if (cqe->res == -EINVAL && net_ring_oneshot == false)
+    {
+        net_ring_oneshot = true; // Kernel without multishot requests
+        ring_arm(sock);
+        return;
+    }
+    if (cqe->res == -ENOBUFS || cqe->res == -EAGAIN || cqe->res == -EINTR)
+    {
+        if (more == false)
+        {
+            ring_arm(sock); // Ran out of provided buffers (recycled by now)
+        }
+        return;
+    }
+    if (op == RING_RECV && cqe->res <= 0)
+    {
+        sock->eof = true; // End of the stream or an error, the receive request is over
+    }
+    sock->event = true;
+    sock_queue(sock);
+    thread_wake(sock->fd);
+    if (more == false && sock->eof == false)
+    {
+        ring_arm(sock);
+    }
+}
+
+
+int net_wait_fd(const word_t net_ref, uint32_t* events)
+{
+    Sock_t* sock = sock_get(net_ref);
+    struct pollfd pfd;
+    ssize_t bytes_recvd;
+    int fd;
+
+    *events = EPOLLIN;
+    if (sock->listener == true)
+    {
+        pfd.fd = sock->fd;
+        pfd.events = POLLIN;
+        return poll(&pfd, 1, 0) == 0 ? sock->fd : -1;
+    }
+    fd = sock_conn_fd(sock, "net_wait_fd");
+    if (sock->recv_pos < sock->recv_len)
+    {
+        return -1;
+    }
+    if (sock_flush(sock) == false && sock->ring == false)
+    {
+        *events |= EPOLLOUT; // The peer may only answer once it got all of it
+    }
+    if (sock->ring == true)
+    {
+        uring_reap();
+        *events = 0; // Woken by the completion
+        return sock->recv_pos < sock->recv_len || sock->eof == true ? -1 : fd;
+    }
+    if (sock->recv_buf == NULL)
+    {
+        sock->recv_buf = (byte_t*)malloc(sock->recv_cap);
+        if (sock->recv_buf == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::net_wait_fd\".\n");
+            destroy_ijvm_now();
+        }
+    }
+
+    // Take what has arrived, the end of the stream and errors are left to the instruction
+    do
+    {
+        bytes_recvd = recv(fd, sock->recv_buf, sock->recv_cap, MSG_DONTWAIT);
+    }
+    while (bytes_recvd < 0 && errno == EINTR);
+    if (bytes_recvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return fd;
+    }
+    if (bytes_recvd > 0)
+    {
+        sock->recv_pos = 0;
+        sock->recv_len = (uint32_t)bytes_recvd;
+    }
+    return -1;
+}
+
+
+word_t net_recv(const word_t net_ref)
+{
+    Sock_t* sock = sock_get(net_ref);
+    ssize_t bytes_recvd = 0;
+    int fd;
+
+    if (sock->recv_pos < sock->recv_len)
+    {
+        return (char)sock->recv_buf[sock->recv_pos++];
+    }
+
+    fd = sock_conn_fd(sock, "net_recv");
+    if (sock->ring == true)
+    {
+        sock_flush(sock);
+        uring_reap(); // Received data is appended to the buffer
+        if (sock->recv_pos < sock->recv_len)
+        {
+            return (char)sock->recv_buf[sock->recv_pos++];
+        }
+        if (sock->eof == true)
+        {
+            return NET_END_OF_STREAM;
+        }
+        uring_submit(); // The program will be waiting for something
+        return NET_WOULD_BLOCK;
+    }
+    if (sock->recv_buf == NULL)
+    {
+        sock->recv_buf = (byte_t*)malloc(sock->recv_cap);
+        if (sock->recv_buf == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::net_recv\".\n");
+            destroy_ijvm_now();
+        }
+    }
+    sock_flush(sock); // The peer may be waiting for it before it answers
+
+    // Receive as much as has arrived
+    do
+    {
+        bytes_recvd = recv(fd, sock->recv_buf, sock->recv_cap, 0);
+    }
+    while (bytes_recvd < 0 && errno == EINTR);
+
     // Verify read
-    if (bytes_sent != 4)
+    if (bytes_recvd < 1 && sock->nonblock == true)
     {
-        fprintf(stderr, "[ERR] Sent unexpected number of bytes. In \"net.c::net_send\".\n");
+        if (bytes_recvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return NET_WOULD_BLOCK;
+        }
+        return NET_END_OF_STREAM;
+    }
+    if (bytes_recvd < 1)
+    {
+        fprintf(stderr, "[ERR] Received unexpected number of bytes. In \"net.c::net_recv\".\n");
         destroy_ijvm_now();
     }
+    sock->recv_pos = 1;
+    sock->recv_len = (uint32_t)bytes_recvd;
+    if (sock->nonblock == true && sock->recv_len > 1)
+    {
+        sock_queue(sock); // Epoll does not know about the bytes left in the buffer
+    }
+    return (char)sock->recv_buf[0];
 }
 
 
-void net_close(const word_t net_ref)
+/**
+* Make room for 'len' more bytes in the send buffer of a socket. A full buffer is sent first and
+* grows if the output cannot be sent yet (non-blocking connections) or does not fit anyway.
+**/
+static void sock_reserve(Sock_t* sock, const uint32_t len)
+{
+    uint64_t new_cap = sock->send_cap;
+    byte_t* new_buf;
+
+    if ((uint64_t)sock->send_len + len > sock->send_cap)
+    {
+        sock_flush(sock);
+    }
+    while ((uint64_t)sock->send_len + len > new_cap)
+    {
+        new_cap *= 2;
+    }
+    if (new_cap > UINT32_MAX)
+    {
+        fprintf(stderr, "[ERR] Too much output is pending. In \"net.c::sock_reserve\".\n");
+        destroy_ijvm_now();
+    }
+    if (new_cap != sock->send_cap || sock->send_buf == NULL) // No buffer after io_uring took it
+    {
+        new_buf = (byte_t*)realloc(sock->send_buf, (size_t)new_cap);
+        if (new_buf == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"net.c::sock_reserve\".\n");
+            destroy_ijvm_now();
+        }
+        sock->send_buf = new_buf;
+        sock->send_cap = (uint32_t)new_cap;
+    }
+}
+
+
+void net_send(const word_t net_ref, const word_t data)
+{
+    Sock_t* sock = sock_get(net_ref);
+
+    sock_conn_fd(sock, "net_send");
+    sock_reserve(sock, sizeof(data));
+
+    // Every NETOUT puts the whole word on the wire
+    memcpy(&sock->send_buf[sock->send_len], &data, sizeof(data));
+    sock->send_len += sizeof(data);
+    if (sock->nonblock == true)
+    {
+        sock_pend(sock);
+    }
+}
+
+
+word_t net_recv_bytes(const word_t net_ref, byte_t* dst, const uint32_t max)
+{
+    Sock_t* sock = sock_get(net_ref);
+    const int fd = sock_conn_fd(sock, "net_recv_bytes");
+    ssize_t bytes_recvd;
+    uint32_t num;
+
+    if (max == 0)
+    {
+        return 0;
+    }
+    if (sock->ring == true && sock->recv_pos >= sock->recv_len)
+    {
+        sock_flush(sock);
+        uring_reap(); // Received data is appended to the buffer
+    }
+    if (sock->recv_pos < sock->recv_len)
+    {
+        num = sock->recv_len - sock->recv_pos < max ? sock->recv_len - sock->recv_pos : max;
+        memcpy(dst, &sock->recv_buf[sock->recv_pos], num);
+        sock->recv_pos += num;
+        return (word_t)num;
+    }
+    if (sock->ring == true)
+    {
+        if (sock->eof == true)
+        {
+            return 0;
+        }
+        uring_submit(); // The program will be waiting for something
+        return NET_WOULD_BLOCK;
+    }
+
+    sock_flush(sock); // The peer may be waiting for it before it answers
+    do
+    {
+        bytes_recvd = recv(fd, dst, max, 0);
+    }
+    while (bytes_recvd < 0 && errno == EINTR);
+    if (bytes_recvd < 0 && sock->nonblock == true && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return NET_WOULD_BLOCK;
+    }
+    return bytes_recvd < 0 ? 0 : (word_t)bytes_recvd;
+}
+
+
+word_t net_send_bytes(const word_t net_ref, const byte_t* src, const uint32_t len)
+{
+    Sock_t* sock = sock_get(net_ref);
+    const int fd = sock_conn_fd(sock, "net_send_bytes");
+    struct iovec iovs[2];
+    struct msghdr msg;
+    ssize_t bytes_sent;
+    uint32_t done = 0;
+
+    if (sock->nonblock == false && (uint64_t)sock->send_len + len > sock->send_cap)
+    {
+        // Send the pending output and the bytes with one call (writev cannot suppress SIGPIPE)
+        iovs[0].iov_base = sock->send_buf;
+        iovs[0].iov_len = sock->send_len;
+        iovs[1].iov_base = (void*)src;
+        iovs[1].iov_len = len;
+        memset(&msg, 0, sizeof(msg));
+        while (iovs[1].iov_len != 0)
+        {
+            msg.msg_iov = iovs[0].iov_len != 0 ? &iovs[0] : &iovs[1];
+            msg.msg_iovlen = iovs[0].iov_len != 0 ? 2 : 1;
+            bytes_sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (bytes_sent < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytes_sent <= 0)
+            {
+                break; // Connection failed, tell the program how much was sent
+            }
+            if ((size_t)bytes_sent < iovs[0].iov_len)
+            {
+                iovs[0].iov_base = (byte_t*)iovs[0].iov_base + bytes_sent;
+                iovs[0].iov_len -= (size_t)bytes_sent;
+                continue;
+            }
+            bytes_sent -= (ssize_t)iovs[0].iov_len;
+            iovs[0].iov_len = 0;
+            iovs[1].iov_base = (byte_t*)iovs[1].iov_base + bytes_sent;
+            iovs[1].iov_len -= (size_t)bytes_sent;
+            done += (uint32_t)bytes_sent;
+        }
+        sock->send_len = 0;
+        return (word_t)done;
+    }
+
+    if (sock->nonblock == true && sock->ring == false && sock->send_len == 0)
+    {
+        // Send what the peer takes right away
+        do
+        {
+            bytes_sent = send(fd, src, len, MSG_NOSIGNAL);
+        }
+        while (bytes_sent < 0 && errno == EINTR);
+        done = bytes_sent > 0 ? (uint32_t)bytes_sent : 0;
+    }
+    if (done < len)
+    {
+        // Buffered like the output of NETOUT
+        sock_reserve(sock, len - done);
+        memcpy(&sock->send_buf[sock->send_len], &src[done], len - done);
+        sock->send_len += len - done;
+        if (sock->nonblock == true)
+        {
+            sock_pend(sock);
+        }
+    }
+    return (word_t)len;
+}
+
+
+/**
+* Close and delete a socket, waiting until 'deadline' (see net_now) at most for the peer of a
+* non-blocking connection to take the rest of the output
+**/
+static void sock_close(const word_t net_ref, const int64_t deadline)
 {
     uint32_t net_i;
     Sock_t* sock;
+    struct pollfd writable;
+    int64_t wait_time;
 
-    net_check_ref(net_ref);
+    sock = sock_get(net_ref);
     net_i = ref_to_index(net_ref);
-    sock = (Sock_t*)marr_get_element(&net_conn, net_i);
+    writable.fd = sock->fd;
+    writable.events = POLLOUT;
+    while (sock_flush(sock) == false)
+    {
+        // Wait a while for the peer of a non-blocking connection to take the rest of the output
+        wait_time = deadline - net_now();
+        if (wait_time <= 0)
+        {
+            break; // Peer stopped reading, the rest is dropped with the socket
+        }
+        if (sock->ring == true)
+        {
+            uring_wait((int32_t)wait_time);
+        }
+        else
+        {
+            poll(&writable, 1, (int)wait_time);
+        }
+    }
+    sock_forget(sock);
     if (sock->client == true)
     {
         shutdown(sock->fd, 2);
@@ -229,27 +1237,72 @@ void net_close(const word_t net_ref)
     }
     if (sock->server == true)
     {
+        shutdown(sock->fds, 2);
+        close(sock->fds);
         shutdown(sock->fd, 2);
         close(sock->fd);
         sock->server = false;
     }
+    if (sock->listener == true)
+    {
+        close(sock->fd);
+        sock->listener = false;
+    }
     // If closing sockets failed, VM can't do anything about it
 
-    free((Sock_t*)marr_get_element(&net_conn, net_i));
-    marr_remove_element(&net_conn, net_i);
+    if (sock->ring_ops == 0)
+    {
+        sock_free(sock);
+    }
+    else
+    {
+        sock->closed = true; // Freed once its canceled requests completed
+    }
+    net_socks[net_i] = NULL;
+    net_free[net_num_free++] = net_i;
+}
+
+
+void net_close(const word_t net_ref)
+{
+    sock_close(net_ref, net_now() + NET_CLOSE_TIMEOUT);
 }
 
 
 void net_destroy(void)
 {
-    for (uint32_t net_i = 0; net_i < net_conn.size; net_i++)
+    const int64_t deadline = net_now() + NET_CLOSE_TIMEOUT; // Shared by all sockets
+
+    for (uint32_t net_i = 0; net_i < net_next_i; net_i++)
     {
-        if (marr_check_marked(&net_conn, net_i) == true)
+        if (net_socks[net_i] != NULL)
         {
-            net_close(index_to_ref(net_i));
+            sock_close(index_to_ref(net_i), deadline);
         }
     }
-    marr_destroy(&net_conn);
+    free(net_socks);
+    free(net_free);
+    net_socks = NULL;
+    net_free = NULL;
+    net_num_free = net_next_i = net_cap = 0;
+    while (net_ring_ops != 0)
+    {
+        uring_wait(-1);
+    }
+    net_ring_state = -1;
+    net_ring_oneshot = false;
+    if (net_epoll != -1)
+    {
+        close(net_epoll);
+        net_epoll = -1;
+    }
+    free(net_ready);
+    free(net_pending);
+    net_ready = NULL;
+    net_pending = NULL;
+    net_ready_head = net_ready_num = net_ready_cap = 0;
+    net_pending_num = net_pending_cap = 0;
+    net_watched = 0;
 }
 
 
@@ -258,9 +1311,9 @@ void net_print(const bool compact)
     if (compact)
     {
         dprintf("NR[");
-        for (uint32_t i = 0; i < net_conn.size; i++)
+        for (uint32_t i = 0; i < net_next_i; i++)
         {
-            if (marr_check_marked(&net_conn, i) == true)
+            if (net_socks[i] != NULL)
             {
                 dprintf(" 0x%X", index_to_ref(i));
             }
@@ -270,9 +1323,9 @@ void net_print(const bool compact)
     else
     {
         dprintf("NR\n");
-        for (uint32_t i = 0; i < net_conn.size; i++)
+        for (uint32_t i = 0; i < net_next_i; i++)
         {
-            if (marr_check_marked(&net_conn, i) == true)
+            if (net_socks[i] != NULL)
             {
                 dprintf("\t0x%X\n", index_to_ref(i));
             }
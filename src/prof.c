@@ -0,0 +1,445 @@
+#define _POSIX_C_SOURCE 200809L // sigaction
+
+
+#include <signal.h>
+
+
+#include "prof.h"
+
+
+/**
+* An instruction that creates arrays
+**/
+typedef struct ProfSite_t
+{
+    uint32_t pc;
+    uint64_t num_samples; // Sampled arrays created here
+    uint64_t bytes; // Total size of the sampled arrays
+}ProfSite_t;
+
+
+/**
+* A sampled array that still exists
+**/
+typedef struct ProfSample_t
+{
+    uint32_t arr_i;
+    uint32_t survivals; // Collections the array survived
+}ProfSample_t;
+
+
+// Declarations of static functions
+static void dump_handler(const int sig);
+static uint32_t next_gap(void);
+static uint32_t get_site(const uint32_t pc);
+static bool grow(void** mem, uint32_t* size, const uint32_t min_size, const size_t el_size);
+static int cmp_bytes(const void* a, const void* b);
+static int cmp_count(const void* a, const void* b);
+static void print_name(FILE* f, const char* name);
+static const char* site_method(const uint32_t pc);
+static void print_sites(FILE* f, const char* key, int (*cmp)(const void*, const void*));
+static void print_histogram(FILE* f, const char* key, const uint64_t* hist);
+
+
+bool g_prof_enabled = false;
+
+static char* out_path = NULL; // Report is written here
+static char* bin_path = NULL; // Program, for its debug symbols
+static volatile sig_atomic_t dump_requested = 0;
+static uint32_t rng_state = 2463534242u; // Fixed seed so runs are reproducible
+static uint32_t countdown = 0; // Arrays to skip before the next sample
+static uint32_t alloc_pc = 0; // Instruction creating arrays, set by prof_site
+static uint64_t num_collections = 0;
+
+static ProfSite_t* sites = NULL;
+static uint32_t num_sites = 0;
+static uint32_t size_sites = 0;
+static uint32_t* site_of_pc = NULL; // Index + 1 of the site of every PC (0 if none yet)
+
+static ProfSample_t* samples = NULL; // Sampled arrays that still exist, in no particular order
+static uint32_t num_samples = 0;
+static uint32_t size_samples = 0;
+static uint32_t* sample_of_arr = NULL; // Index + 1 of the sample of every array index (0 if not sampled)
+static uint32_t size_sample_of_arr = 0;
+
+static uint64_t hist_freed[PROF_MAX_SURVIVALS + 1]; // Survivals of sampled arrays that were removed
+static uint64_t hist_live[PROF_MAX_SURVIVALS + 1]; // Survivals of sampled arrays that still exist
+
+static const DebugData_t* symbols = NULL; // Only loaded while a report is written
+
+
+/**
+* Ask for a report at the next array creation or collection (only sets a flag to be signal-safe)
+**/
+static void dump_handler(const int sig)
+{
+    (void)sig;
+    dump_requested = 1;
+}
+
+
+/**
+* Return the number of arrays until the next sample, uniform over [1, 2 * PROF_SAMPLE_EVERY - 1]
+* so PROF_SAMPLE_EVERY on average (xorshift32)
+**/
+static uint32_t next_gap(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return 1 + rng_state % (2 * PROF_SAMPLE_EVERY - 1);
+}
+
+
+/**
+* Return the index of the site of an instruction, adding it if needed
+**/
+static uint32_t get_site(const uint32_t pc)
+{
+    if (site_of_pc[pc] != 0)
+    {
+        return site_of_pc[pc] - 1;
+    }
+    if (grow((void**)&sites, &size_sites, num_sites + 1, sizeof(ProfSite_t)) != true)
+    {
+        fprintf(stderr, "[ERR] Failed to allocate memory. In \"prof.c::get_site\".\n");
+        destroy_ijvm_now();
+    }
+    sites[num_sites].pc = pc;
+    sites[num_sites].num_samples = 0;
+    sites[num_sites].bytes = 0;
+    site_of_pc[pc] = ++num_sites;
+    return num_sites - 1;
+}
+
+
+/**
+* Make sure memory holds at least 'min_size' elements (new elements are zeroed)
+* Return  true on success
+*         false on failure (memory remains the same)
+**/
+static bool grow(void** mem, uint32_t* size, const uint32_t min_size, const size_t el_size)
+{
+    uint32_t new_size = *size == 0 ? 64 : *size;
+    void* new_mem;
+
+    if (min_size <= *size)
+    {
+        return true;
+    }
+    while (new_size < min_size)
+    {
+        new_size *= 2;
+    }
+    new_mem = realloc(*mem, new_size * el_size);
+    if (new_mem == NULL)
+    {
+        return false;
+    }
+    memset((byte_t*)new_mem + *size * el_size, 0, (new_size - *size) * el_size);
+    *mem = new_mem;
+    *size = new_size;
+    return true;
+}
+
+
+void prof_init(const char* prog_path)
+{
+    const char* path = getenv("IJVM_HEAP_PROFILE");
+    struct sigaction action;
+
+    prof_destroy();
+    if (path == NULL || path[0] == '\0')
+    {
+        return;
+    }
+
+    out_path = str_dup(path);
+    bin_path = str_dup(prog_path);
+    site_of_pc = (uint32_t*)calloc((size_t)g_cpu->code_mem_size + 1, sizeof(uint32_t));
+    if (out_path == NULL || bin_path == NULL || site_of_pc == NULL)
+    {
+        fprintf(stderr, "[ERR] Failed to allocate memory. In \"prof.c::prof_init\".\n");
+        prof_destroy();
+        return;
+    }
+    memset(hist_freed, 0, sizeof(hist_freed));
+    memset(hist_live, 0, sizeof(hist_live));
+    num_collections = 0;
+    countdown = next_gap();
+
+    // Restart interrupted system calls, the program must not notice the signal
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = dump_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+    g_prof_enabled = true;
+    dprintf("[HEAP PROFILE %s]\n", out_path);
+}
+
+
+void prof_site(const int32_t pc)
+{
+    alloc_pc = (uint32_t)pc;
+}
+
+
+void prof_alloc(const uint32_t arr_i, const size_t size)
+{
+    ProfSample_t* sample;
+    uint32_t site_i;
+
+    if (dump_requested != 0)
+    {
+        prof_dump();
+    }
+    if (--countdown != 0)
+    {
+        return;
+    }
+    countdown = next_gap();
+
+    if (grow((void**)&samples, &size_samples, num_samples + 1, sizeof(ProfSample_t)) != true ||
+        grow((void**)&sample_of_arr, &size_sample_of_arr, arr_i + 1, sizeof(uint32_t)) != true)
+    {
+        fprintf(stderr, "[ERR] Failed to allocate memory. In \"prof.c::prof_alloc\".\n");
+        destroy_ijvm_now();
+    }
+    site_i = get_site(alloc_pc);
+    sites[site_i].num_samples++;
+    sites[site_i].bytes += size;
+
+    sample = &samples[num_samples];
+    sample->arr_i = arr_i;
+    sample->survivals = 0;
+    sample_of_arr[arr_i] = ++num_samples;
+}
+
+
+void prof_collect(const bool* marked, const uint32_t num_marked)
+{
+    num_collections++;
+    for (uint32_t sample_i = 0; sample_i < num_samples; sample_i++)
+    {
+        if (samples[sample_i].arr_i < num_marked && marked[samples[sample_i].arr_i] == true)
+        {
+            samples[sample_i].survivals++;
+        }
+    }
+    if (dump_requested != 0)
+    {
+        prof_dump();
+    }
+}
+
+
+void prof_free(const uint32_t arr_i)
+{
+    uint32_t sample_i;
+    uint32_t survivals;
+
+    if (arr_i >= size_sample_of_arr || sample_of_arr[arr_i] == 0)
+    {
+        return;
+    }
+    sample_i = sample_of_arr[arr_i] - 1;
+    sample_of_arr[arr_i] = 0;
+
+    survivals = samples[sample_i].survivals;
+    hist_freed[survivals < PROF_MAX_SURVIVALS ? survivals : PROF_MAX_SURVIVALS]++;
+
+    // Move the last sample into the hole
+    samples[sample_i] = samples[--num_samples];
+    if (sample_i != num_samples)
+    {
+        sample_of_arr[samples[sample_i].arr_i] = sample_i + 1;
+    }
+}
+
+
+static int cmp_bytes(const void* a, const void* b)
+{
+    const ProfSite_t* site_a = &sites[*(const uint32_t*)a];
+    const ProfSite_t* site_b = &sites[*(const uint32_t*)b];
+    return (site_a->bytes < site_b->bytes) - (site_a->bytes > site_b->bytes);
+}
+
+
+static int cmp_count(const void* a, const void* b)
+{
+    const ProfSite_t* site_a = &sites[*(const uint32_t*)a];
+    const ProfSite_t* site_b = &sites[*(const uint32_t*)b];
+    return (site_a->num_samples < site_b->num_samples) - (site_a->num_samples > site_b->num_samples);
+}
+
+
+/**
+* Print a string as a JSON string
+**/
+static void print_name(FILE* f, const char* name)
+{
+    fputc('"', f);
+    for (; *name != '\0'; name++)
+    {
+        if (*name == '"' || *name == '\\')
+        {
+            fputc('\\', f);
+        }
+        if ((unsigned char)*name >= 0x20)
+        {
+            fputc(*name, f);
+        }
+    }
+    fputc('"', f);
+}
+
+
+/**
+* Return the name of the method (function label) containing an address or "??" if unknown.
+* Function labels are sorted by address.
+**/
+static const char* site_method(const uint32_t pc)
+{
+    int64_t label_i = -1;
+
+    if (symbols == NULL)
+    {
+        return "??";
+    }
+    while (label_i + 1 < symbols->func_label.num && symbols->func_label.addr[label_i + 1] <= pc)
+    {
+        label_i++;
+    }
+    if (label_i < 0)
+    {
+        return "??";
+    }
+    return &symbols->func_label.names[symbols->func_label.names_start[label_i]];
+}
+
+
+/**
+* Print the top sites in the order given by a comparison function (of site indices)
+**/
+static void print_sites(FILE* f, const char* key, int (*cmp)(const void*, const void*))
+{
+    uint32_t* order = (uint32_t*)malloc((num_sites + 1) * sizeof(uint32_t));
+    const ProfSite_t* site;
+
+    fprintf(f, "  \"%s\": [", key);
+    if (order == NULL)
+    {
+        fprintf(f, "],\n");
+        return;
+    }
+    for (uint32_t site_i = 0; site_i < num_sites; site_i++)
+    {
+        order[site_i] = site_i;
+    }
+    qsort(order, num_sites, sizeof(uint32_t), cmp);
+
+    for (uint32_t rank = 0; rank < num_sites && rank < PROF_TOP_SITES; rank++)
+    {
+        site = &sites[order[rank]];
+        fprintf(f, "%s\n    {\"pc\": %u, \"op\": \"%s\", \"method\": ", rank == 0 ? "" : ",",
+            site->pc, op_decode((g_cpu->code_mem)[site->pc]));
+        print_name(f, site_method(site->pc));
+        fprintf(f, ", \"samples\": %lu, \"arrays\": %lu, \"bytes\": %lu}",
+            (unsigned long)site->num_samples, (unsigned long)(site->num_samples * PROF_SAMPLE_EVERY),
+            (unsigned long)(site->bytes * PROF_SAMPLE_EVERY));
+    }
+    fprintf(f, "%s],\n", num_sites == 0 ? "" : "\n  ");
+    free(order);
+}
+
+
+/**
+* Print a survival histogram, scaled up to estimated arrays
+**/
+static void print_histogram(FILE* f, const char* key, const uint64_t* hist)
+{
+    fprintf(f, "    \"%s\": [", key);
+    for (uint32_t bucket = 0; bucket <= PROF_MAX_SURVIVALS; bucket++)
+    {
+        fprintf(f, "%s%lu", bucket == 0 ? "" : ", ", (unsigned long)(hist[bucket] * PROF_SAMPLE_EVERY));
+    }
+    fprintf(f, "]");
+}
+
+
+void prof_dump(void)
+{
+    DebugData_t debug_data;
+    FILE* f;
+    uint32_t survivals;
+
+    dump_requested = 0;
+    if (g_prof_enabled != true)
+    {
+        return;
+    }
+    f = fopen(out_path, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "[ERR] Failed to open %s. In \"prof.c::prof_dump\".\n", out_path);
+        return;
+    }
+
+    memset(&debug_data, 0, sizeof(debug_data));
+    symbols = read_debug_data(bin_path, &debug_data) == true ? &debug_data : NULL;
+
+    // Arrays that still exist are counted apart, they may survive more collections
+    memset(hist_live, 0, sizeof(hist_live));
+    for (uint32_t sample_i = 0; sample_i < num_samples; sample_i++)
+    {
+        survivals = samples[sample_i].survivals;
+        hist_live[survivals < PROF_MAX_SURVIVALS ? survivals : PROF_MAX_SURVIVALS]++;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"sample_every\": %u,\n", PROF_SAMPLE_EVERY);
+    fprintf(f, "  \"collections\": %lu,\n", (unsigned long)num_collections);
+    print_sites(f, "sites_by_bytes", cmp_bytes);
+    print_sites(f, "sites_by_count", cmp_count);
+    fprintf(f, "  \"survivals\": {\n");
+    print_histogram(f, "freed", hist_freed);
+    fprintf(f, ",\n");
+    print_histogram(f, "live", hist_live);
+    fprintf(f, "\n  }\n}\n");
+    fclose(f);
+
+    if (symbols != NULL)
+    {
+        free_debug_data(&debug_data);
+        symbols = NULL;
+    }
+}
+
+
+void prof_destroy(void)
+{
+    if (g_prof_enabled == true)
+    {
+        prof_dump();
+        signal(SIGUSR1, SIG_DFL);
+    }
+    g_prof_enabled = false;
+    free(out_path);
+    free(bin_path);
+    free(site_of_pc);
+    free(sites);
+    free(samples);
+    free(sample_of_arr);
+    out_path = NULL;
+    bin_path = NULL;
+    site_of_pc = NULL;
+    sites = NULL;
+    samples = NULL;
+    sample_of_arr = NULL;
+    num_sites = 0;
+    size_sites = 0;
+    num_samples = 0;
+    size_samples = 0;
+    size_sample_of_arr = 0;
+}
@@ -0,0 +1,135 @@
+#include "scan.h"
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+
+// Declarations of static functions
+static inline void report_matches(const word_t* words, uint32_t matches, ScanMatch_t on_match);
+static uint32_t scan_block_scalar(const word_t* words, const uint32_t mask, const uint32_t pattern);
+#ifdef SCAN_X86
+static uint32_t scan_block_sse2(const word_t* words, const uint32_t mask, const uint32_t pattern);
+static uint32_t scan_block_avx2(const word_t* words, const uint32_t mask, const uint32_t pattern);
+#endif
+
+
+/**
+* A block kernel tests 8 consecutive words and returns a bit mask of matches (bit n = word n)
+**/
+typedef uint32_t (*ScanBlock_t)(const word_t* words, const uint32_t mask, const uint32_t pattern);
+
+static ScanBlock_t scan_block = scan_block_scalar;
+static const char* scan_block_name = "scalar";
+
+
+/**
+* Pass every word whose bit is set in 'matches' to the callback
+**/
+static inline void report_matches(const word_t* words, uint32_t matches, ScanMatch_t on_match)
+{
+    while (matches != 0)
+    {
+        on_match(words[__builtin_ctz(matches)]);
+        matches &= matches - 1; // Clear lowest set bit
+    }
+}
+
+
+static uint32_t scan_block_scalar(const word_t* words, const uint32_t mask, const uint32_t pattern)
+{
+    uint32_t matches = 0;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        matches |= (uint32_t)((((uint32_t)words[i] & mask) ^ pattern) == 0) << i;
+    }
+    return matches;
+}
+
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static uint32_t scan_block_sse2(const word_t* words, const uint32_t mask, const uint32_t pattern)
+{
+    const __m128i v_mask = _mm_set1_epi32((int)mask);
+    const __m128i v_pattern = _mm_set1_epi32((int)pattern);
+    const __m128i lo = _mm_loadu_si128((const __m128i*)words);
+    const __m128i hi = _mm_loadu_si128((const __m128i*)(words + 4));
+    const __m128i lo_eq = _mm_cmpeq_epi32(_mm_and_si128(lo, v_mask), v_pattern);
+    const __m128i hi_eq = _mm_cmpeq_epi32(_mm_and_si128(hi, v_mask), v_pattern);
+    return (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(lo_eq)) |
+           ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(hi_eq)) << 4);
+}
+
+
+__attribute__((target("avx2")))
+static uint32_t scan_block_avx2(const word_t* words, const uint32_t mask, const uint32_t pattern)
+{
+    const __m256i v_mask = _mm256_set1_epi32((int)mask);
+    const __m256i v_pattern = _mm256_set1_epi32((int)pattern);
+    const __m256i block = _mm256_loadu_si256((const __m256i*)words);
+    const __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(block, v_mask), v_pattern);
+    return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq));
+}
+#endif
+
+
+void scan_init(void)
+{
+    scan_block = scan_block_scalar;
+    scan_block_name = "scalar";
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_block = scan_block_avx2;
+        scan_block_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        scan_block = scan_block_sse2;
+        scan_block_name = "sse2";
+    }
+#endif
+    dprintf("[SCAN KERNEL %s]\n", scan_block_name);
+}
+
+
+void scan_words(const word_t* words, const uint32_t num, const uint32_t mask, const uint32_t pattern, ScanMatch_t on_match)
+{
+    const ScanBlock_t kernel = scan_block;
+    uint32_t i = 0;
+
+    for (; i + 8 <= num; i += 8)
+    {
+        report_matches(&words[i], kernel(&words[i], mask, pattern), on_match);
+    }
+
+    // Remaining (less than 8) words
+    for (; i < num; i++)
+    {
+        if ((((uint32_t)words[i] & mask) ^ pattern) == 0)
+        {
+            on_match(words[i]);
+        }
+    }
+}
+
+
+void scan_tagged(const word_t* words, const uint32_t* tags, const uint32_t num, ScanMatch_t on_match)
+{
+    uint32_t tag_i = 0;
+
+    for (; (tag_i + 1) * 32 <= num; tag_i++)
+    {
+        report_matches(&words[tag_i * 32], tags[tag_i], on_match);
+    }
+
+    // Remaining (less than 32) words, bits past the end may be stale
+    if (tag_i * 32 < num)
+    {
+        report_matches(&words[tag_i * 32], tags[tag_i] & ((1u << (num - tag_i * 32)) - 1), on_match);
+    }
+}
@@ -0,0 +1,1053 @@
+#include "stackmap.h"
+
+
+#define STATE_WORDS (SMAP_MAX_SLOTS / 32) // Words of reference bits kept per analysed instruction
+
+#define ROLE_NONE ((byte_t)0)
+#define ROLE_OP   ((byte_t)1) // Byte is fetched as an op-code
+#define ROLE_ARG  ((byte_t)2) // Byte is an instruction argument or part of a method header
+
+
+typedef enum EMapType { MAP_SAFEPOINT, MAP_CALL }EMapType;
+
+
+/**
+* Which slots of a frame may hold array references at one point in the program.
+* Bit n of the map covers local variable n for n < nv and operand stack slot (n - nv) otherwise.
+**/
+typedef struct SMap_t
+{
+    int32_t nv;
+    int32_t depth; // Operand stack depth
+    uint32_t bits; // Offset of bit 0 in the bit pool
+    EMapType type; // Safepoints are valid for the executing frame, calls for the frames below it
+}SMap_t;
+
+
+typedef struct SMethod_t
+{
+    int32_t entry; // Address of the first instruction
+    int32_t nv;
+    int32_t num_args;
+    bool failed; // Analysis could not decide, frames of this method are scanned conservatively
+    bool escapes; // An array created by the method may outlive its frame
+}SMethod_t;
+
+
+/**
+* Abstract state of a frame while analysing one instruction
+**/
+typedef struct SState_t
+{
+    int32_t nv;
+    int32_t depth;
+    uint32_t bits[STATE_WORDS];
+    uint32_t local[STATE_WORDS]; // Slots that may hold an array created by the frame itself
+    bool failed;
+}SState_t;
+
+
+// Declarations of static functions
+static int32_t decode(const int32_t pc, byte_t* op, int32_t* arg);
+static bool claim_bytes(const int32_t pc, const int32_t len, const bool wide);
+static int32_t find_method(const int32_t header);
+static void analyse_method(const int32_t method_i);
+static void merge(const int32_t method_i, const int32_t pc, const SState_t* state);
+static inline bool get_bit(const uint32_t* bits, const int32_t i);
+static inline void set_bit(uint32_t* bits, const int32_t i, const bool val);
+static void state_push(SState_t* state, const bool ref);
+static void state_push_local(SState_t* state);
+static void state_push_slot(SState_t* state, const int32_t slot);
+static bool state_pop(SState_t* state);
+static void state_pop_escaping(SState_t* state, const int32_t method_i);
+static bool emit_map(const int32_t key, const SState_t* state, const int32_t depth, const EMapType type);
+static void emit_maps(void);
+static void forget_failed_ops(void);
+static void free_analysis(void);
+static const SMap_t* find_map(const int32_t key, const EMapType type);
+static void add_root(const word_t word);
+static void add_root_range(const int32_t from, const int32_t to);
+
+
+// Analysis data, only alive during smap_build
+static int32_t* owner = NULL; // Method that owns an instruction
+static int32_t* in_depth = NULL; // Operand stack depth on entry of an instruction (-1 if not reached)
+static uint32_t* in_bits = NULL;
+static uint32_t* in_local = NULL;
+static int32_t* worklist = NULL;
+static bool* queued = NULL; // Address is on the work list
+static uint32_t num_work = 0;
+static SMethod_t* methods = NULL;
+static uint32_t num_methods = 0;
+static uint32_t size_methods = 0;
+static bool analysis_failed = false;
+
+// Stack maps
+static bool maps_built = false;
+static byte_t* roles = NULL; // Role of every byte of code memory (kept for smap_is_op)
+static bool* frame_local = NULL; // Op-codes creating arrays that never outlive their frame
+static int32_t* map_at = NULL; // Index of the map for every address (-1 if there is none)
+static SMap_t* maps = NULL;
+static uint32_t num_maps = 0;
+static uint32_t size_maps = 0;
+static uint32_t* bit_pool = NULL;
+static uint32_t num_pool_bits = 0;
+static uint32_t size_pool_words = 0;
+static int32_t main_fp = 0;
+
+// Root buffer handed to the garbage collector
+static word_t* roots_buf = NULL;
+static uint32_t num_roots_buf = 0;
+static uint32_t size_roots_buf = 0;
+static bool roots_failed = false;
+
+
+/**
+* Decode the instruction at pc (WIDE is decoded together with the instruction it prefixes).
+* Return  length of the instruction in bytes
+*         0 if the instruction does not fit in code memory or can not be analysed
+**/
+static int32_t decode(const int32_t pc, byte_t* op, int32_t* arg)
+{
+    int32_t len;
+    bool wide = false;
+    int32_t op_pc = pc;
+
+    *op = (g_cpu->code_mem)[pc];
+    if (*op == OP_WIDE)
+    {
+        if (pc + 1 >= g_cpu->code_mem_size || (g_cpu->code_mem)[pc + 1] == OP_WIDE)
+        {
+            return 0;
+        }
+        wide = true;
+        op_pc = pc + 1;
+        *op = (g_cpu->code_mem)[op_pc];
+    }
+
+    switch (*op)
+    {
+    case OP_BIPUSH:
+    case OP_MULTINEWARRAY:
+    case OP_MALOAD:
+    case OP_MASTORE:
+        len = 2;
+        break;
+    case OP_ILOAD:
+    case OP_ISTORE:
+        len = wide ? 3 : 2;
+        break;
+    case OP_IINC:
+        len = wide ? 4 : 3;
+        break;
+    case OP_LDC_W:
+    case OP_IFEQ:
+    case OP_IFLT:
+    case OP_ICMPEQ:
+    case OP_GOTO:
+    case OP_INVOKEVIRTUAL:
+    case OP_SPAWN:
+        len = 3;
+        break;
+    default:
+        len = 1;
+    }
+    if (op_pc + len > g_cpu->code_mem_size)
+    {
+        return 0;
+    }
+
+    switch (*op)
+    {
+    case OP_BIPUSH:
+        *arg = (int8_t)get_code_byte(op_pc + 1);
+        break;
+    case OP_ILOAD:
+    case OP_ISTORE:
+    case OP_IINC:
+        *arg = wide ? (uint16_t)get_code_short(op_pc + 1) : get_code_byte(op_pc + 1);
+        break;
+    case OP_MULTINEWARRAY:
+    case OP_MALOAD:
+    case OP_MASTORE:
+        *arg = get_code_byte(op_pc + 1); // Number of dimensions
+        break;
+    case OP_LDC_W:
+    case OP_INVOKEVIRTUAL:
+    case OP_SPAWN:
+        *arg = (uint16_t)get_code_short(op_pc + 1);
+        break;
+    case OP_IFEQ:
+    case OP_IFLT:
+    case OP_ICMPEQ:
+    case OP_GOTO:
+        *arg = (int16_t)get_code_short(op_pc + 1);
+        break;
+    default:
+        *arg = 0;
+    }
+    return (op_pc - pc) + len;
+}
+
+
+/**
+* Record which bytes of an instruction are op-codes and which are arguments.
+* Return  false if a byte was already claimed in a different role (overlapping instructions)
+**/
+static bool claim_bytes(const int32_t pc, const int32_t len, const bool wide)
+{
+    for (int32_t i = 0; i < len; i++)
+    {
+        const byte_t role = (i == 0 || (wide && i == 1)) ? ROLE_OP : ROLE_ARG;
+        if (roles[pc + i] != ROLE_NONE && roles[pc + i] != role)
+        {
+            return false;
+        }
+        roles[pc + i] = role;
+    }
+    return true;
+}
+
+
+/**
+* Return the index of the method whose header is at the given address, adding it if needed.
+* Return  method index on success
+*         -1 if the header is invalid
+**/
+static int32_t find_method(const int32_t header)
+{
+    SMethod_t* tmp_methods;
+
+    if (header < 0 || header + 4 > g_cpu->code_mem_size)
+    {
+        return -1;
+    }
+    for (uint32_t method_i = 0; method_i < num_methods; method_i++)
+    {
+        if (methods[method_i].entry == header + 4)
+        {
+            return (int32_t)method_i;
+        }
+    }
+
+    if (num_methods == size_methods)
+    {
+        tmp_methods = (SMethod_t*)realloc(methods, (size_methods * 2 + 8) * sizeof(SMethod_t));
+        if (tmp_methods == NULL)
+        {
+            analysis_failed = true;
+            return -1;
+        }
+        methods = tmp_methods;
+        size_methods = size_methods * 2 + 8;
+    }
+    for (int32_t i = 0; i < 4; i++)
+    {
+        if (roles[header + i] == ROLE_OP)
+        {
+            analysis_failed = true; // Header is never executed
+            return -1;
+        }
+        roles[header + i] = ROLE_ARG;
+    }
+
+    methods[num_methods].entry = header + 4;
+    methods[num_methods].num_args = (uint16_t)get_code_short(header);
+    methods[num_methods].nv = methods[num_methods].num_args + (uint16_t)get_code_short(header + 2);
+    methods[num_methods].failed = false;
+    methods[num_methods].escapes = false;
+    return (int32_t)num_methods++;
+}
+
+
+static inline bool get_bit(const uint32_t* bits, const int32_t i)
+{
+    return (bits[i / 32] >> (i % 32)) & 1;
+}
+
+
+static inline void set_bit(uint32_t* bits, const int32_t i, const bool val)
+{
+    if (val)
+    {
+        bits[i / 32] |= (uint32_t)1 << (i % 32);
+    }
+    else
+    {
+        bits[i / 32] &= ~((uint32_t)1 << (i % 32));
+    }
+}
+
+
+static void state_push(SState_t* state, const bool ref)
+{
+    if (state->nv + state->depth >= SMAP_MAX_SLOTS)
+    {
+        state->failed = true;
+        return;
+    }
+    set_bit(state->bits, state->nv + state->depth, ref);
+    set_bit(state->local, state->nv + state->depth, false);
+    state->depth++;
+}
+
+
+/**
+* Push a reference to an array created by the frame itself
+**/
+static void state_push_local(SState_t* state)
+{
+    state_push(state, true);
+    if (!state->failed)
+    {
+        set_bit(state->local, state->nv + state->depth - 1, true);
+    }
+}
+
+
+/**
+* Push a copy of a slot (local variable or operand stack)
+**/
+static void state_push_slot(SState_t* state, const int32_t slot)
+{
+    const bool local = get_bit(state->local, slot);
+    state_push(state, get_bit(state->bits, slot));
+    if (!state->failed)
+    {
+        set_bit(state->local, state->nv + state->depth - 1, local);
+    }
+}
+
+
+static bool state_pop(SState_t* state)
+{
+    if (state->depth <= 0)
+    {
+        state->failed = true;
+        return true;
+    }
+    state->depth--;
+    return get_bit(state->bits, state->nv + state->depth);
+}
+
+
+/**
+* Pop a word that leaves the frame (returned, stored in an array, passed to a callee, or used in
+* arithmetic which may reproduce it), arrays created by the method may then outlive its frame
+**/
+static void state_pop_escaping(SState_t* state, const int32_t method_i)
+{
+    state_pop(state);
+    if (!state->failed && get_bit(state->local, state->nv + state->depth))
+    {
+        methods[method_i].escapes = true;
+    }
+}
+
+
+/**
+* Merge a state into the entry state of the instruction at pc and queue it if anything changed
+**/
+static void merge(const int32_t method_i, const int32_t pc, const SState_t* state)
+{
+    bool changed = false;
+    uint32_t* bits;
+    uint32_t* local;
+
+    if (pc < 0 || pc >= g_cpu->code_mem_size)
+    {
+        return; // Jumping outside of code memory stops the machine
+    }
+    if (owner[pc] != -1 && owner[pc] != method_i)
+    {
+        analysis_failed = true; // Code shared by several methods
+        return;
+    }
+
+    bits = &in_bits[(uint32_t)pc * STATE_WORDS];
+    local = &in_local[(uint32_t)pc * STATE_WORDS];
+    if (in_depth[pc] == -1)
+    {
+        owner[pc] = method_i;
+        in_depth[pc] = state->depth;
+        memcpy(bits, state->bits, sizeof(state->bits));
+        memcpy(local, state->local, sizeof(state->local));
+        changed = true;
+    }
+    else if (in_depth[pc] != state->depth)
+    {
+        methods[method_i].failed = true; // Stack depth depends on the path taken
+        return;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < STATE_WORDS; i++)
+        {
+            changed |= (bits[i] | state->bits[i]) != bits[i] || (local[i] | state->local[i]) != local[i];
+            bits[i] |= state->bits[i];
+            local[i] |= state->local[i];
+        }
+    }
+
+    if (changed && !queued[pc])
+    {
+        queued[pc] = true;
+        worklist[num_work++] = pc;
+    }
+}
+
+
+/**
+* Propagate which slots may hold array references through every instruction of a method
+**/
+static void analyse_method(const int32_t method_i)
+{
+    SState_t state;
+    int32_t pc, len, arg, callee_i;
+    byte_t op;
+
+    if (methods[method_i].nv > SMAP_MAX_SLOTS)
+    {
+        methods[method_i].failed = true;
+        return;
+    }
+
+    // Arguments may be references, the remaining local variables start as 0
+    memset(&state, 0, sizeof(state));
+    state.nv = methods[method_i].nv;
+    for (int32_t i = 0; i < methods[method_i].num_args; i++)
+    {
+        set_bit(state.bits, i, true);
+    }
+    merge(method_i, methods[method_i].entry, &state);
+
+    while (num_work > 0 && !methods[method_i].failed && !analysis_failed)
+    {
+        pc = worklist[--num_work];
+        queued[pc] = false;
+        state.nv = methods[method_i].nv;
+        state.depth = in_depth[pc];
+        state.failed = false;
+        memcpy(state.bits, &in_bits[(uint32_t)pc * STATE_WORDS], sizeof(state.bits));
+        memcpy(state.local, &in_local[(uint32_t)pc * STATE_WORDS], sizeof(state.local));
+
+        len = decode(pc, &op, &arg);
+        if (len == 0)
+        {
+            continue; // Machine stops with an error here
+        }
+        if (!claim_bytes(pc, len, (g_cpu->code_mem)[pc] == OP_WIDE))
+        {
+            analysis_failed = true;
+            break;
+        }
+
+        switch (op)
+        {
+        case OP_NOP:
+        case OP_GC:
+            break;
+        case OP_BIPUSH:
+        case OP_LDC_W:
+        case OP_IN:
+            state_push(&state, false);
+            break;
+        case OP_ILOAD:
+            if (arg >= state.nv)
+            {
+                state.failed = true;
+                break;
+            }
+            state_push_slot(&state, arg);
+            break;
+        case OP_ISTORE:
+            if (arg >= state.nv)
+            {
+                state.failed = true;
+                break;
+            }
+            set_bit(state.bits, arg, state_pop(&state));
+            set_bit(state.local, arg, get_bit(state.local, state.nv + state.depth));
+            break;
+        case OP_IINC:
+            if (arg >= state.nv)
+            {
+                state.failed = true;
+                break;
+            }
+            methods[method_i].escapes |= get_bit(state.local, arg); // Same as arithmetic
+            set_bit(state.bits, arg, false);
+            set_bit(state.local, arg, false);
+            break;
+        case OP_POP:
+        case OP_OUT:
+        case OP_NETCLOSE:
+            state_pop(&state);
+            break;
+        case OP_DUP:
+            if (state.depth <= 0)
+            {
+                state.failed = true;
+                break;
+            }
+            state_push_slot(&state, state.nv + state.depth - 1);
+            break;
+        case OP_SWAP:
+        {
+            const bool b_local = state.depth >= 1 && get_bit(state.local, state.nv + state.depth - 1);
+            const bool a_local = state.depth >= 2 && get_bit(state.local, state.nv + state.depth - 2);
+            const bool b = state_pop(&state);
+            const bool a = state_pop(&state);
+            state_push(&state, b);
+            state_push(&state, a);
+            if (!state.failed)
+            {
+                set_bit(state.local, state.nv + state.depth - 2, b_local);
+                set_bit(state.local, state.nv + state.depth - 1, a_local);
+            }
+            break;
+        }
+        case OP_IADD:
+        case OP_ISUB:
+        case OP_IAND:
+        case OP_IOR:
+            // Arithmetic never produces a reference
+            state_pop_escaping(&state, method_i);
+            state_pop_escaping(&state, method_i);
+            state_push(&state, false);
+            break;
+        case OP_IFEQ:
+        case OP_IFLT:
+            state_pop(&state);
+            merge(method_i, pc + arg, &state);
+            break;
+        case OP_ICMPEQ:
+            state_pop(&state);
+            state_pop(&state);
+            merge(method_i, pc + arg, &state);
+            break;
+        case OP_GOTO:
+            merge(method_i, pc + arg, &state);
+            continue;
+        case OP_INVOKEVIRTUAL:
+            if (arg >= g_cpu->const_mem_size / 4 ||
+                (callee_i = find_method(get_constant(arg))) < 0)
+            {
+                continue; // Invalid method stops the machine
+            }
+            for (int32_t i = 0; i < methods[callee_i].num_args; i++)
+            {
+                state_pop_escaping(&state, method_i);
+            }
+            state_push(&state, true); // Return value may be a reference
+            break;
+        case OP_SPAWN:
+            if (arg >= g_cpu->const_mem_size / 4 ||
+                (callee_i = find_method(get_constant(arg))) < 0)
+            {
+                continue; // Invalid method stops the machine
+            }
+            // Arguments move to the stack of the new thread
+            for (int32_t i = 0; i < methods[callee_i].num_args; i++)
+            {
+                state_pop_escaping(&state, method_i);
+            }
+            state_push(&state, false);
+            break;
+        case OP_YIELD:
+            break;
+        case OP_JOIN:
+            state_pop(&state);
+            state_push(&state, true); // Result may be a reference
+            break;
+        case OP_NEWARRAY:
+        case OP_NEWBYTEARRAY:
+            state_pop(&state);
+            state_push_local(&state);
+            break;
+        case OP_INMAP:
+            state_push(&state, true);
+            break;
+        case OP_IALOAD:
+            // Arrays are scanned conservatively so loaded elements may be references
+            state_pop(&state);
+            state_pop(&state);
+            state_push(&state, true);
+            break;
+        case OP_BALOAD:
+            // Bytes are never references
+            state_pop(&state);
+            state_pop(&state);
+            state_push(&state, false);
+            break;
+        case OP_IASTORE:
+            state_pop(&state);
+            state_pop(&state);
+            state_pop_escaping(&state, method_i);
+            break;
+        case OP_BASTORE:
+            // Only the lowest 8 bits are stored
+            state_pop(&state);
+            state_pop(&state);
+            state_pop(&state);
+            break;
+        case OP_MULTINEWARRAY:
+            for (int32_t i = 0; i < arg; i++)
+            {
+                state_pop(&state);
+            }
+            state_push_local(&state);
+            break;
+        case OP_MALOAD:
+            // Same as IALOAD, elements may be references
+            for (int32_t i = 0; i < arg + 1; i++)
+            {
+                state_pop(&state);
+            }
+            state_push(&state, true);
+            break;
+        case OP_MASTORE:
+            for (int32_t i = 0; i < arg + 1; i++)
+            {
+                state_pop(&state);
+            }
+            state_pop_escaping(&state, method_i); // Value
+            break;
+        case OP_ARRAYFILL:
+            state_pop_escaping(&state, method_i); // Value
+            for (int32_t i = 0; i < 3; i++)
+            {
+                state_pop(&state);
+            }
+            break;
+        case OP_ARRAYCOPY:
+            for (int32_t i = 0; i < 5; i++)
+            {
+                state_pop(&state);
+            }
+            break;
+        case OP_INARRAY:
+            // Input bytes are never references
+            for (int32_t i = 0; i < 3; i++)
+            {
+                state_pop(&state);
+            }
+            state_push(&state, false);
+            break;
+        case OP_OUTARRAY:
+            for (int32_t i = 0; i < 3; i++)
+            {
+                state_pop(&state);
+            }
+            break;
+        case OP_NETBIND:
+        case OP_NETIN:
+        case OP_NETLISTEN:
+        case OP_NETACCEPT:
+        case OP_NETPOLL:
+            state_pop(&state);
+            state_push(&state, false);
+            break;
+        case OP_NETINARRAY:
+        case OP_NETOUTARRAY:
+            // Byte counts are never references
+            for (int32_t i = 0; i < 4; i++)
+            {
+                state_pop(&state);
+            }
+            state_push(&state, false);
+            break;
+        case OP_NETCONNECT:
+            state_pop(&state);
+            state_pop(&state);
+            state_push(&state, false);
+            break;
+        case OP_NETOUT:
+            state_pop(&state);
+            state_pop(&state);
+            break;
+        case OP_IRETURN:
+            state_pop_escaping(&state, method_i);
+            continue;
+        default:
+            continue; // HALT, ERR, and invalid instructions end the path
+        }
+
+        if (state.failed)
+        {
+            methods[method_i].failed = true;
+            break;
+        }
+        merge(method_i, pc + len, &state);
+    }
+    num_work = 0;
+}
+
+
+/**
+* Add a stack map for the given address using the first nv + depth slots of a state
+* Return  false on failure
+**/
+static bool emit_map(const int32_t key, const SState_t* state, const int32_t depth, const EMapType type)
+{
+    const uint32_t num_bits = (uint32_t)(state->nv + depth);
+    SMap_t* tmp_maps;
+    uint32_t* tmp_pool;
+
+    if (depth < 0 || key > g_cpu->code_mem_size)
+    {
+        return true; // Machine stops with an error before reaching this point
+    }
+    if (num_maps == size_maps)
+    {
+        tmp_maps = (SMap_t*)realloc(maps, (size_maps * 2 + 64) * sizeof(SMap_t));
+        if (tmp_maps == NULL)
+        {
+            return false;
+        }
+        maps = tmp_maps;
+        size_maps = size_maps * 2 + 64;
+    }
+    if ((num_pool_bits + num_bits + 31) / 32 > size_pool_words)
+    {
+        tmp_pool = (uint32_t*)realloc(bit_pool, (size_pool_words * 2 + STATE_WORDS) * sizeof(uint32_t));
+        if (tmp_pool == NULL)
+        {
+            return false;
+        }
+        memset(&tmp_pool[size_pool_words], 0, (size_pool_words + STATE_WORDS) * sizeof(uint32_t));
+        bit_pool = tmp_pool;
+        size_pool_words = size_pool_words * 2 + STATE_WORDS;
+    }
+
+    maps[num_maps].nv = state->nv;
+    maps[num_maps].depth = depth;
+    maps[num_maps].bits = num_pool_bits;
+    maps[num_maps].type = type;
+    for (uint32_t i = 0; i < num_bits; i++)
+    {
+        set_bit(bit_pool, (int32_t)(num_pool_bits + i), get_bit(state->bits, (int32_t)i));
+    }
+    num_pool_bits += num_bits;
+    map_at[key] = (int32_t)num_maps++;
+    return true;
+}
+
+
+/**
+* Create stack maps for every point at which the garbage collector may look at a frame and
+* record which instructions create arrays that never outlive their frame
+**/
+static void emit_maps(void)
+{
+    SState_t state;
+    int32_t len, arg, callee_i;
+    byte_t op;
+
+    for (int32_t pc = 0; pc < g_cpu->code_mem_size && !analysis_failed; pc++)
+    {
+        if (in_depth[pc] == -1 || methods[owner[pc]].failed)
+        {
+            continue;
+        }
+        state.nv = methods[owner[pc]].nv;
+        memcpy(state.bits, &in_bits[(uint32_t)pc * STATE_WORDS], sizeof(state.bits));
+
+        len = decode(pc, &op, &arg);
+        if (len == 0)
+        {
+            continue;
+        }
+        // Main never returns, its arrays are left to the garbage collector
+        if ((op == OP_NEWARRAY || op == OP_NEWBYTEARRAY || op == OP_MULTINEWARRAY) && owner[pc] != 0 &&
+            !methods[owner[pc]].escapes)
+        {
+            frame_local[(g_cpu->code_mem)[pc] == OP_WIDE ? pc + 1 : pc] = true; // Keyed by the op-code itself
+        }
+        switch (op)
+        {
+        case OP_NEWARRAY:
+        case OP_NEWBYTEARRAY:
+            // Collection happens once the size was popped and before the reference is pushed
+            analysis_failed |= !emit_map(pc + len, &state, in_depth[pc] - 1, MAP_SAFEPOINT);
+            break;
+        case OP_MULTINEWARRAY:
+            analysis_failed |= !emit_map(pc + len, &state, in_depth[pc] - arg, MAP_SAFEPOINT);
+            break;
+        case OP_GC:
+        case OP_INMAP:
+            analysis_failed |= !emit_map(pc + len, &state, in_depth[pc], MAP_SAFEPOINT);
+            break;
+        case OP_INVOKEVIRTUAL:
+            // Caller frames are looked at (from the return address) with the arguments already moved to the callee
+            if (arg < g_cpu->const_mem_size / 4 && (callee_i = find_method(get_constant(arg))) >= 0)
+            {
+                analysis_failed |= !emit_map(pc + len, &state, in_depth[pc] - methods[callee_i].num_args, MAP_CALL);
+            }
+            break;
+        }
+    }
+}
+
+
+/**
+* Stop reporting the instructions of methods whose analysis failed as op-codes: paths that were
+* never explored may fetch the same bytes as arguments
+**/
+static void forget_failed_ops(void)
+{
+    for (int32_t pc = 0; pc < g_cpu->code_mem_size; pc++)
+    {
+        if (owner[pc] == -1 || !methods[owner[pc]].failed)
+        {
+            continue;
+        }
+        roles[pc] = ROLE_NONE;
+        if ((g_cpu->code_mem)[pc] == OP_WIDE && pc + 1 < g_cpu->code_mem_size)
+        {
+            roles[pc + 1] = ROLE_NONE; // Op-code prefixed by WIDE
+        }
+    }
+}
+
+
+static void free_analysis(void)
+{
+    free(owner);
+    free(in_depth);
+    free(in_bits);
+    free(in_local);
+    free(worklist);
+    free(queued);
+    free(methods);
+    owner = NULL;
+    in_depth = NULL;
+    in_bits = NULL;
+    in_local = NULL;
+    worklist = NULL;
+    queued = NULL;
+    methods = NULL;
+    num_work = 0;
+    num_methods = 0;
+    size_methods = 0;
+}
+
+
+void smap_build(void)
+{
+    const uint32_t code_size = (uint32_t)g_cpu->code_mem_size;
+
+    smap_destroy();
+    analysis_failed = false;
+    main_fp = g_cpu->fp;
+
+    roles = (byte_t*)calloc(code_size + 1, sizeof(byte_t));
+    owner = (int32_t*)malloc((code_size + 1) * sizeof(int32_t));
+    in_depth = (int32_t*)malloc((code_size + 1) * sizeof(int32_t));
+    in_bits = (uint32_t*)malloc((code_size + 1) * STATE_WORDS * sizeof(uint32_t));
+    in_local = (uint32_t*)malloc((code_size + 1) * STATE_WORDS * sizeof(uint32_t));
+    worklist = (int32_t*)malloc((code_size + 1) * sizeof(int32_t));
+    queued = (bool*)calloc(code_size + 1, sizeof(bool));
+    map_at = (int32_t*)malloc((code_size + 1) * sizeof(int32_t));
+    frame_local = (bool*)calloc(code_size + 1, sizeof(bool));
+    methods = (SMethod_t*)malloc(8 * sizeof(SMethod_t));
+    if (roles == NULL || owner == NULL || in_depth == NULL || in_bits == NULL || in_local == NULL ||
+        worklist == NULL || queued == NULL || map_at == NULL || frame_local == NULL || methods == NULL)
+    {
+        free_analysis();
+        smap_destroy();
+        return; // Garbage collector stays conservative
+    }
+    for (uint32_t pc = 0; pc <= code_size; pc++)
+    {
+        owner[pc] = -1;
+        in_depth[pc] = -1;
+        map_at[pc] = -1;
+    }
+
+    // Main method starts at 0 without a header
+    size_methods = 8;
+    num_methods = 1;
+    methods[0].entry = 0;
+    methods[0].nv = g_cpu->nv;
+    methods[0].num_args = 0;
+    methods[0].failed = false;
+    methods[0].escapes = false;
+
+    // Methods are added while analysing calls
+    for (uint32_t method_i = 0; method_i < num_methods && !analysis_failed; method_i++)
+    {
+        analyse_method((int32_t)method_i);
+    }
+    if (!analysis_failed)
+    {
+        emit_maps();
+        forget_failed_ops();
+    }
+
+    free_analysis();
+    if (analysis_failed)
+    {
+        smap_destroy();
+        dprintf("[STACK MAPS FAILED]\n");
+        return;
+    }
+    maps_built = true;
+    dprintf("[STACK MAPS %u]\n", num_maps);
+}
+
+
+/**
+* Return the stack map of a given type at an address (or NULL if there is none)
+**/
+static const SMap_t* find_map(const int32_t key, const EMapType type)
+{
+    if (key < 0 || key > g_cpu->code_mem_size || map_at[key] == -1 || maps[map_at[key]].type != type)
+    {
+        return NULL;
+    }
+    return &maps[map_at[key]];
+}
+
+
+static void add_root(const word_t word)
+{
+    word_t* tmp_buf;
+    if (num_roots_buf == size_roots_buf)
+    {
+        tmp_buf = (word_t*)realloc(roots_buf, (size_roots_buf * 2 + 256) * sizeof(word_t));
+        if (tmp_buf == NULL)
+        {
+            roots_failed = true;
+            return;
+        }
+        roots_buf = tmp_buf;
+        size_roots_buf = size_roots_buf * 2 + 256;
+    }
+    roots_buf[num_roots_buf++] = word;
+}
+
+
+/**
+* Add all stack words from 'from' to 'to' (inclusive) as roots
+**/
+static void add_root_range(const int32_t from, const int32_t to)
+{
+    for (int32_t i = from; i <= to && !roots_failed; i++)
+    {
+        add_root((g_cpu->stack)[i]);
+    }
+}
+
+
+uint32_t smap_roots(const word_t** roots, const bool is_main)
+{
+    int32_t lv = g_cpu->lv;
+    int32_t nv = g_cpu->nv;
+    int32_t fp = g_cpu->fp;
+    int32_t top = g_cpu->sp;
+    int32_t key = g_cpu->pc;
+    EMapType type = MAP_SAFEPOINT;
+    const word_t* stack = g_cpu->stack;
+    const SMap_t* map;
+    bool is_base;
+    int32_t ops;
+
+    if (!maps_built)
+    {
+        *roots = g_cpu->stack;
+        return (uint32_t)(g_cpu->sp + 1);
+    }
+
+    num_roots_buf = 0;
+    roots_failed = false;
+    for (;;)
+    {
+        // Frames called from the main frame lie above it, so only the main frame itself is at main_fp
+        is_base = is_main && fp == main_fp;
+        ops = is_base ? fp : fp + 4; // Operand stack starts above the frame link (main has none)
+
+        map = find_map(key, type);
+        if (map != NULL && map->nv == nv && lv + nv == fp && map->depth == top - ops + 1)
+        {
+            for (int32_t i = 0; i < nv + map->depth; i++)
+            {
+                if (get_bit(bit_pool, (int32_t)map->bits + i))
+                {
+                    add_root(stack[i < nv ? lv + i : ops + (i - nv)]);
+                }
+            }
+        }
+        else
+        {
+            add_root_range(lv, top); // Frame can not be decided, scan all of it
+        }
+
+        if (is_base)
+        {
+            break;
+        }
+
+        // Move on to the calling frame using the frame link
+        if (fp < 0 || fp + 3 > top)
+        {
+            break;
+        }
+        top = lv - 1;
+        key = stack[fp + 3];
+        lv = stack[fp];
+        nv = stack[fp + 1];
+        fp = stack[fp + 2];
+        type = MAP_CALL;
+        if (lv < 0 || nv < 0 || fp < lv || fp > top + 1)
+        {
+            lv = top + 1; // Frame link was overwritten, the rest is scanned conservatively
+            break;
+        }
+    }
+    add_root_range(0, lv - 1);
+
+    if (roots_failed)
+    {
+        *roots = g_cpu->stack;
+        return (uint32_t)(g_cpu->sp + 1);
+    }
+    *roots = roots_buf;
+    return num_roots_buf;
+}
+
+
+bool smap_is_op(const int32_t pc)
+{
+    return maps_built && pc >= 0 && pc < g_cpu->code_mem_size && roles[pc] == ROLE_OP;
+}
+
+
+bool smap_is_frame_local(const int32_t pc)
+{
+    return maps_built && pc >= 0 && pc < g_cpu->code_mem_size && frame_local[pc];
+}
+
+
+void smap_destroy(void)
+{
+    free(roles);
+    roles = NULL;
+    free(frame_local);
+    frame_local = NULL;
+    free(map_at);
+    free(maps);
+    free(bit_pool);
+    free(roots_buf);
+    map_at = NULL;
+    maps = NULL;
+    bit_pool = NULL;
+    roots_buf = NULL;
+    num_maps = 0;
+    size_maps = 0;
+    num_pool_bits = 0;
+    size_pool_words = 0;
+    num_roots_buf = 0;
+    size_roots_buf = 0;
+    maps_built = false;
+}
@@ -4,8 +4,13 @@
 void destroy_ijvm(void)
 {
     // ISO-IEC 9899: free(NULL) becomes a NOP
+    io_destroy();
     net_destroy();
+    uring_destroy(); // Every request completed above
+    prof_destroy(); // Reports arrays that still exist, before they are removed
     arr_destroy();
+    smap_destroy();
+    thread_destroy(); // The stack of the running thread is freed with the CPU
     cpu_destroy();
     dprintf("[DESTROY IJVM]\n");
 }
@@ -0,0 +1,604 @@
+#include "thread.h"
+
+
+typedef enum EThreadState { THREAD_RUNNING, THREAD_READY, THREAD_PARKED, THREAD_JOINING, THREAD_ENDED }EThreadState;
+
+
+/**
+* Stack and registers of a thread, saved while another thread runs
+**/
+typedef struct Thread_t
+{
+    word_t* stack;
+#ifdef GC_TAGS
+    uint32_t* stack_tags;
+#endif
+    int stack_size;
+    int pc;
+    int sp;
+    int fp;
+    int lv;
+    int nv;
+    int base_fp; // Frame the thread was spawned with, returning from it ends the thread (-1 for main)
+    uint32_t index;
+    EThreadState state;
+    struct Thread_t* next; // Next thread in the run queue or parked on the same file descriptor
+    struct Thread_t* joiner; // Thread waiting in JOIN for this one, kept until it took the result
+}Thread_t;
+
+
+/**
+* Threads parked on a file descriptor
+**/
+typedef struct ThreadWait_t
+{
+    Thread_t* parked;
+    uint32_t events; // Epoll events the file descriptor is watched for
+}ThreadWait_t;
+
+
+// Declarations of static functions
+static inline uint32_t ref_to_index(const word_t thread_ref);
+static inline word_t index_to_ref(const uint32_t thread_i);
+static Thread_t* thread_alloc(const int stack_size);
+static Thread_t* thread_get(const word_t thread_ref);
+static void thread_remove(Thread_t* thread);
+static void thread_save(Thread_t* thread);
+static void thread_load(const Thread_t* thread);
+static void thread_queue(Thread_t* thread);
+static void thread_schedule(void);
+static int thread_watch(const int op, const int fd, const uint32_t events);
+static void thread_poll(const int32_t timeout);
+
+
+bool g_threads = false;
+
+static const uint32_t k_index_to_ref = 0xBB00000B;
+static const uint32_t k_ref_to_index = 0x00FFFFF0;
+
+static Thread_t** threads = NULL; // Indexed by thread index (NULL if the index is free)
+static uint32_t* free_indices = NULL; // Released indices, reused last in first out
+static uint32_t num_free = 0;
+static uint32_t next_index = 0; // Indices from here on were never used
+static uint32_t threads_cap = 0;
+
+static Thread_t* running = NULL; // Thread in the CPU (NULL until the first SPAWN)
+static Thread_t* run_head = NULL; // Run queue, threads are taken from the head
+static Thread_t* run_tail = NULL;
+
+static ThreadWait_t* waits = NULL; // Indexed by file descriptor
+static uint32_t waits_cap = 0;
+static uint32_t num_parked = 0; // Threads parked on a file descriptor
+static int thread_epoll = -1; // Watches the file descriptors threads are parked on
+static bool ring_watched = false; // thread_epoll watches the io_uring file descriptor
+
+
+/**
+* Recover thread index from thread reference
+**/
+static inline uint32_t ref_to_index(const word_t thread_ref)
+{
+    return (k_ref_to_index & (uint32_t)thread_ref) >> 4;
+}
+
+
+/**
+* Create a thread reference from thread index
+**/
+static inline word_t index_to_ref(const uint32_t thread_i)
+{
+    return (word_t)(k_index_to_ref | (thread_i << 4));
+}
+
+
+/**
+* Create a thread with a stack of 'stack_size' elements (none if 0) and give it an index
+**/
+static Thread_t* thread_alloc(const int stack_size)
+{
+    Thread_t* thread = (Thread_t*)calloc(1, sizeof(Thread_t));
+    Thread_t** tmp_threads;
+    uint32_t* tmp_indices;
+    const uint32_t new_cap = threads_cap * 2 + THREADS_MIN_NUM;
+
+    if (thread == NULL)
+    {
+        fprintf(stderr, "[ERR] Failed to allocate memory. In \"thread.c::thread_alloc\".\n");
+        destroy_ijvm_now();
+        return NULL;
+    }
+    if (stack_size > 0)
+    {
+        thread->stack = (word_t*)malloc((uint32_t)stack_size * sizeof(word_t));
+#ifdef GC_TAGS
+        thread->stack_tags = (uint32_t*)calloc(TAG_WORDS(stack_size), sizeof(uint32_t)); // No word is a reference yet
+        if (thread->stack == NULL || thread->stack_tags == NULL)
+#else
+        if (thread->stack == NULL)
+#endif
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"thread.c::thread_alloc\".\n");
+            destroy_ijvm_now();
+        }
+        thread->stack_size = stack_size;
+    }
+
+    if (num_free == 0 && next_index == threads_cap)
+    {
+        if (new_cap > THREADS_MAX_NUM)
+        {
+            fprintf(stderr, "[ERR] Program requires more threads than is possible. In \"thread.c::thread_alloc\".\n");
+            destroy_ijvm_now();
+        }
+        tmp_threads = (Thread_t**)realloc(threads, new_cap * sizeof(Thread_t*));
+        tmp_indices = tmp_threads == NULL ? NULL : (uint32_t*)realloc(free_indices, new_cap * sizeof(uint32_t));
+        if (tmp_threads == NULL || tmp_indices == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"thread.c::thread_alloc\".\n");
+            destroy_ijvm_now();
+        }
+        threads = tmp_threads;
+        free_indices = tmp_indices;
+        threads_cap = new_cap;
+    }
+    thread->index = num_free > 0 ? free_indices[--num_free] : next_index++;
+    threads[thread->index] = thread;
+    return thread;
+}
+
+
+/**
+* Return the thread behind a thread reference
+**/
+static Thread_t* thread_get(const word_t thread_ref)
+{
+    const uint32_t thread_i = ref_to_index(thread_ref);
+
+    if ((((uint32_t)thread_ref & 0xFF00000F) ^ k_index_to_ref) != 0 || thread_i >= next_index ||
+        threads[thread_i] == NULL)
+    {
+        fprintf(stderr, "[ERR] Invalid thread reference. In \"thread.c::thread_get\".\n");
+        destroy_ijvm_now();
+    }
+    return threads[thread_i];
+}
+
+
+/**
+* Free a thread that is not running and release its index
+**/
+static void thread_remove(Thread_t* thread)
+{
+    threads[thread->index] = NULL;
+    free_indices[num_free++] = thread->index;
+    free(thread->stack);
+#ifdef GC_TAGS
+    free(thread->stack_tags);
+#endif
+    free(thread);
+}
+
+
+/**
+* Save the stack and registers of the CPU in a thread
+**/
+static void thread_save(Thread_t* thread)
+{
+    thread->stack = g_cpu->stack;
+#ifdef GC_TAGS
+    thread->stack_tags = g_cpu->stack_tags;
+#endif
+    thread->stack_size = g_cpu->stack_size;
+    thread->pc = g_cpu->pc;
+    thread->sp = g_cpu->sp;
+    thread->fp = g_cpu->fp;
+    thread->lv = g_cpu->lv;
+    thread->nv = g_cpu->nv;
+}
+
+
+/**
+* Load the stack and registers of a thread into the CPU
+**/
+static void thread_load(const Thread_t* thread)
+{
+    g_cpu->stack = thread->stack;
+#ifdef GC_TAGS
+    g_cpu->stack_tags = thread->stack_tags;
+#endif
+    g_cpu->stack_size = thread->stack_size;
+    g_cpu->pc = thread->pc;
+    g_cpu->sp = thread->sp;
+    g_cpu->fp = thread->fp;
+    g_cpu->lv = thread->lv;
+    g_cpu->nv = thread->nv;
+}
+
+
+/**
+* Append a thread to the run queue
+**/
+static void thread_queue(Thread_t* thread)
+{
+    thread->state = THREAD_READY;
+    thread->next = NULL;
+    if (run_tail == NULL)
+    {
+        run_head = thread;
+    }
+    else
+    {
+        run_tail->next = thread;
+    }
+    run_tail = thread;
+}
+
+
+/**
+* Save the running thread (which was queued, parked, or ended already) and load the first thread
+* of the run queue. Waits for parked threads while the run queue is empty.
+**/
+static void thread_schedule(void)
+{
+    thread_save(running);
+    while (run_head == NULL)
+    {
+        if (num_parked == 0)
+        {
+            fprintf(stderr, "[ERR] All threads are waiting for each other. In \"thread.c::thread_schedule\".\n");
+            destroy_ijvm_now();
+        }
+        thread_poll(-1);
+    }
+    running = run_head;
+    run_head = running->next;
+    if (run_head == NULL)
+    {
+        run_tail = NULL;
+    }
+    running->state = THREAD_RUNNING;
+    thread_load(running);
+}
+
+
+/**
+* Add (or change) a file descriptor watched by thread_epoll, which is created on the first call
+* Return  result of epoll_ctl
+**/
+static int thread_watch(const int op, const int fd, const uint32_t events)
+{
+    struct epoll_event event;
+
+    if (thread_epoll == -1)
+    {
+        thread_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (thread_epoll == -1)
+        {
+            fprintf(stderr, "[ERR] Failed to create an epoll instance. In \"thread.c::thread_watch\".\n");
+            destroy_ijvm_now();
+        }
+    }
+    event.events = events;
+    event.data.fd = fd;
+    return epoll_ctl(thread_epoll, op, fd, &event);
+}
+
+
+/**
+* Wait up to 'timeout' milliseconds (forever if negative) for file descriptors threads are parked
+* on and wake those threads. With io_uring its completions wake threads as well.
+**/
+static void thread_poll(const int32_t timeout)
+{
+    static struct epoll_event events[THREAD_POLL_EVENTS];
+    const int ring_fd = uring_fd();
+    int32_t wait_time = timeout;
+    int num_events;
+
+    if (ring_fd != -1)
+    {
+        if (ring_watched == false)
+        {
+            if (thread_watch(EPOLL_CTL_ADD, ring_fd, EPOLLIN) == -1)
+            {
+                fprintf(stderr, "[ERR] Failed to watch io_uring. In \"thread.c::thread_poll\".\n");
+                destroy_ijvm_now();
+            }
+            ring_watched = true;
+        }
+        uring_reap(); // Completions that are there already, their handlers may queue requests
+        uring_submit();
+        if (run_head != NULL)
+        {
+            wait_time = 0;
+        }
+    }
+    if (thread_epoll == -1)
+    {
+        return; // Nothing is watched
+    }
+
+    do
+    {
+        num_events = epoll_wait(thread_epoll, events, THREAD_POLL_EVENTS, wait_time);
+    }
+    while (num_events == -1 && errno == EINTR);
+    for (int i = 0; i < num_events; i++)
+    {
+        if (events[i].data.fd == ring_fd)
+        {
+            uring_wait(0); // Its handlers wake threads, entering the kernel flushes completions it holds back
+        }
+        else
+        {
+            thread_wake(events[i].data.fd);
+        }
+    }
+}
+
+
+word_t thread_spawn(const int32_t method)
+{
+    const uint16_t num_args = (uint16_t)get_code_short(method);
+    const uint16_t num_locals = (uint16_t)get_code_short(method + 2);
+    const int nv = (int)num_args + num_locals;
+    const int first_arg = g_cpu->sp - num_args + 1;
+    int stack_size = THREAD_STACK_MIN_SIZE;
+    Thread_t* thread;
+
+    if (first_arg < g_cpu->lv)
+    {
+        fprintf(stderr, "[ERR] Method provided an invalid number of arguments. In \"thread.c::thread_spawn\".\n");
+        destroy_ijvm_now();
+    }
+    if (running == NULL)
+    {
+        // The main thread is the one running so far
+        running = thread_alloc(0);
+        running->base_fp = -1;
+        running->state = THREAD_RUNNING;
+    }
+    while (stack_size < nv + 4 + 256) // 256 is an arbitrary margin for operands
+    {
+        stack_size *= 8;
+    }
+    thread = thread_alloc(stack_size);
+
+    // Arguments move to the new stack, they are the first local variables of the method
+    memcpy(thread->stack, &g_cpu->stack[first_arg], num_args * sizeof(word_t));
+#ifdef GC_TAGS
+    for (int arg_i = 0; arg_i < num_args; arg_i++)
+    {
+        tag_set(thread->stack_tags, (uint32_t)arg_i, tag_get(g_cpu->stack_tags, (uint32_t)(first_arg + arg_i)));
+    }
+#endif
+    g_cpu->sp = first_arg - 1;
+    memset(&thread->stack[num_args], 0, num_locals * sizeof(word_t));
+
+    // Frame link leads nowhere, IRETURN ends the thread instead of following it
+    thread->stack[nv] = -1;
+    thread->stack[nv + 1] = 0;
+    thread->stack[nv + 2] = -1;
+    thread->stack[nv + 3] = -1;
+    thread->lv = 0;
+    thread->nv = nv;
+    thread->fp = nv;
+    thread->sp = nv + 3;
+    thread->pc = method + 4;
+    thread->base_fp = nv;
+    thread_queue(thread);
+    g_threads = true;
+    return index_to_ref(thread->index);
+}
+
+
+void thread_yield(void)
+{
+    if (g_threads == false)
+    {
+        return;
+    }
+    if (num_parked > 0)
+    {
+        thread_poll(0);
+    }
+    if (run_head == NULL)
+    {
+        return; // No other thread can run
+    }
+    thread_queue(running);
+    thread_schedule();
+}
+
+
+bool thread_park(const int fd, const uint32_t events)
+{
+    ThreadWait_t* tmp_waits;
+    uint32_t new_cap = waits_cap;
+
+    if (fd < 0)
+    {
+        return false;
+    }
+    if ((uint32_t)fd >= waits_cap)
+    {
+        while ((uint32_t)fd >= new_cap)
+        {
+            new_cap = new_cap * 2 + THREADS_MIN_NUM;
+        }
+        tmp_waits = (ThreadWait_t*)realloc(waits, new_cap * sizeof(ThreadWait_t));
+        if (tmp_waits == NULL)
+        {
+            fprintf(stderr, "[ERR] Failed to allocate memory. In \"thread.c::thread_park\".\n");
+            destroy_ijvm_now();
+        }
+        memset(&tmp_waits[waits_cap], 0, (new_cap - waits_cap) * sizeof(ThreadWait_t));
+        waits = tmp_waits;
+        waits_cap = new_cap;
+    }
+
+    if (events != 0)
+    {
+        // Armed once, woken threads park (and arm it) again if they still have to wait
+        if (thread_watch(EPOLL_CTL_MOD, fd, waits[fd].events | events | EPOLLONESHOT) == -1 &&
+            (errno != ENOENT || thread_watch(EPOLL_CTL_ADD, fd, waits[fd].events | events | EPOLLONESHOT) == -1))
+        {
+            return false; // E.g. a regular file, reading it never waits
+        }
+        waits[fd].events |= events;
+    }
+    running->state = THREAD_PARKED;
+    running->next = waits[fd].parked;
+    waits[fd].parked = running;
+    num_parked++;
+    thread_schedule();
+    return true;
+}
+
+
+void thread_wake(const int fd)
+{
+    Thread_t* thread;
+
+    if (fd < 0 || (uint32_t)fd >= waits_cap)
+    {
+        return;
+    }
+    while ((thread = waits[fd].parked) != NULL)
+    {
+        waits[fd].parked = thread->next;
+        num_parked--;
+        thread_queue(thread);
+    }
+    waits[fd].events = 0;
+}
+
+
+bool thread_join(const word_t thread_ref, word_t* result, bool* tag)
+{
+    Thread_t* thread = thread_get(thread_ref);
+
+    if (thread == running)
+    {
+        fprintf(stderr, "[ERR] Thread tried to join itself. In \"thread.c::thread_join\".\n");
+        destroy_ijvm_now();
+    }
+    if (thread->joiner != NULL && thread->joiner != running)
+    {
+        fprintf(stderr, "[ERR] Thread is joined by another thread already. In \"thread.c::thread_join\".\n");
+        destroy_ijvm_now();
+    }
+    if (thread->state == THREAD_ENDED)
+    {
+        *result = thread->stack[0];
+#ifdef GC_TAGS
+        *tag = tag_get(thread->stack_tags, 0);
+#else
+        *tag = false;
+#endif
+        thread_remove(thread);
+        return true;
+    }
+
+    running->state = THREAD_JOINING;
+    thread->joiner = running;
+    thread_schedule();
+    return false;
+}
+
+
+bool thread_end(const int32_t fp, const word_t result, const bool tag)
+{
+    word_t* tmp_stack;
+
+    if (g_threads == false || running->base_fp != fp)
+    {
+        return false;
+    }
+
+    // Only the result is kept (it may be an array reference) until a thread joins
+    tmp_stack = (word_t*)realloc(g_cpu->stack, sizeof(word_t));
+    if (tmp_stack != NULL)
+    {
+        g_cpu->stack = tmp_stack;
+        g_cpu->stack_size = 1;
+    }
+    g_cpu->stack[0] = result;
+#ifdef GC_TAGS
+    tag_set(g_cpu->stack_tags, 0, tag);
+#else
+    (void)tag;
+#endif
+    g_cpu->sp = 0;
+    g_cpu->lv = 0;
+    g_cpu->nv = 1;
+    g_cpu->fp = -1;
+    g_cpu->pc = -1;
+    running->state = THREAD_ENDED;
+
+    if (running->joiner != NULL)
+    {
+        thread_queue(running->joiner); // Its JOIN takes the result when it runs again
+    }
+    thread_schedule();
+    return true;
+}
+
+
+bool thread_in_main(void)
+{
+    return running == NULL || running->base_fp == -1;
+}
+
+
+void thread_visit(void (*visit)(const bool is_main))
+{
+    if (g_threads == false)
+    {
+        return;
+    }
+    thread_save(running);
+    for (uint32_t thread_i = 0; thread_i < next_index; thread_i++)
+    {
+        if (threads[thread_i] != NULL && threads[thread_i] != running)
+        {
+            thread_load(threads[thread_i]);
+            visit(threads[thread_i]->base_fp == -1);
+        }
+    }
+    thread_load(running);
+}
+
+
+void thread_destroy(void)
+{
+    for (uint32_t thread_i = 0; thread_i < next_index; thread_i++)
+    {
+        if (threads[thread_i] != NULL && threads[thread_i] != running)
+        {
+            thread_remove(threads[thread_i]);
+        }
+    }
+    free(running); // Its stack is the one in the CPU
+    free(threads);
+    free(free_indices);
+    free(waits);
+    if (thread_epoll != -1)
+    {
+        close(thread_epoll);
+    }
+    g_threads = false;
+    threads = NULL;
+    free_indices = NULL;
+    num_free = 0;
+    next_index = 0;
+    threads_cap = 0;
+    running = NULL;
+    run_head = NULL;
+    run_tail = NULL;
+    waits = NULL;
+    waits_cap = 0;
+    num_parked = 0;
+    thread_epoll = -1;
+    ring_watched = false;
+}
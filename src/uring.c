@@ -0,0 +1,401 @@
+#define _DEFAULT_SOURCE // syscall
+
+
+#include "uring.h"
+
+
+// Declarations of static functions
+static bool ring_setup(void);
+static bool ring_probe(void);
+static int ring_enter(const uint32_t to_submit, const uint32_t min_complete, const uint32_t flags, const void* arg, const size_t arg_size);
+
+
+static const uint8_t k_required_ops[] = {IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_POLL_ADD,
+    IORING_OP_ASYNC_CANCEL, IORING_OP_SEND, IORING_OP_RECV};
+
+static int8_t ring_state = -1; // Not set up yet (-1), unusable (0), or usable (1)
+static int ring_fd = -1;
+static UringHandler_t ring_handlers[URING_OWNERS] = {NULL};
+
+// Shared with the kernel
+static void* sq_mem = NULL;
+static size_t sq_mem_size = 0;
+static void* cq_mem = NULL;
+static size_t cq_mem_size = 0;
+static struct io_uring_sqe* sqes = NULL;
+static size_t sqes_size = 0;
+static uint32_t* sq_head;
+static uint32_t* sq_tail;
+static uint32_t* sq_array;
+static uint32_t sq_mask;
+static uint32_t sq_entries;
+static uint32_t* cq_head;
+static uint32_t* cq_tail;
+static struct io_uring_cqe* cqes;
+static uint32_t cq_mask;
+
+static uint32_t sq_queued = 0; // Entries filled in but not submitted yet
+
+// Provided buffers for receiving
+static struct io_uring_buf_ring* buf_ring = NULL;
+static size_t buf_ring_size = 0;
+static byte_t* bufs = NULL;
+static uint16_t buf_tail = 0;
+static bool bufs_registered = false;
+
+
+/**
+* Create the ring and map its queues
+* Return  true on success
+**/
+static bool ring_setup(void)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring_fd < 0)
+    {
+        return false; // No io_uring in this kernel (or it is disabled)
+    }
+    if ((params.features & IORING_FEAT_EXT_ARG) == 0 || (params.features & IORING_FEAT_RW_CUR_POS) == 0 ||
+        (params.features & IORING_FEAT_NODROP) == 0)
+    {
+        return false; // Timed waits, reads and writes at the file position, or no lost completions
+    }
+
+    sq_mem_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_mem_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0 && cq_mem_size > sq_mem_size)
+    {
+        sq_mem_size = cq_mem_size;
+    }
+    sq_mem = mmap(NULL, sq_mem_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_mem == MAP_FAILED)
+    {
+        sq_mem = NULL;
+        return false;
+    }
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+    {
+        cq_mem = sq_mem;
+    }
+    else
+    {
+        cq_mem = mmap(NULL, cq_mem_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_mem == MAP_FAILED)
+        {
+            cq_mem = NULL;
+            return false;
+        }
+    }
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        sqes = NULL;
+        return false;
+    }
+
+    sq_head = (uint32_t*)((byte_t*)sq_mem + params.sq_off.head);
+    sq_tail = (uint32_t*)((byte_t*)sq_mem + params.sq_off.tail);
+    sq_array = (uint32_t*)((byte_t*)sq_mem + params.sq_off.array);
+    sq_mask = *(uint32_t*)((byte_t*)sq_mem + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    cq_head = (uint32_t*)((byte_t*)cq_mem + params.cq_off.head);
+    cq_tail = (uint32_t*)((byte_t*)cq_mem + params.cq_off.tail);
+    cqes = (struct io_uring_cqe*)((byte_t*)cq_mem + params.cq_off.cqes);
+    cq_mask = *(uint32_t*)((byte_t*)cq_mem + params.cq_off.ring_mask);
+
+    // Entries of the submission queue are used in order
+    for (uint32_t i = 0; i < sq_entries; i++)
+    {
+        sq_array[i] = i;
+    }
+    return ring_probe();
+}
+
+
+/**
+* Return  true if the kernel supports every operation the VM uses
+**/
+static bool ring_probe(void)
+{
+    const size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, probe_size);
+    bool supported = probe != NULL;
+
+    if (supported && syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    {
+        supported = false;
+    }
+    for (uint32_t i = 0; supported && i < sizeof(k_required_ops); i++)
+    {
+        supported = k_required_ops[i] <= probe->last_op && (probe->ops[k_required_ops[i]].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+    free(probe);
+    return supported;
+}
+
+
+/**
+* Wrapper of the io_uring_enter system call
+**/
+static int ring_enter(const uint32_t to_submit, const uint32_t min_complete, const uint32_t flags, const void* arg, const size_t arg_size)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+
+bool uring_enabled(void)
+{
+    const char* use = getenv("IJVM_IO_URING");
+
+    if (ring_state != -1)
+    {
+        return ring_state == 1;
+    }
+    ring_state = 0;
+    if (use == NULL || use[0] == '\0' || use[0] == '0')
+    {
+        return false;
+    }
+    if (ring_setup() == true)
+    {
+        ring_state = 1;
+    }
+    else
+    {
+        uring_destroy(); // Use the classic system calls
+        ring_state = 0;
+    }
+    dprintf("[IO_URING %d]\n", ring_state);
+    return ring_state == 1;
+}
+
+
+int uring_fd(void)
+{
+    return ring_state == 1 ? ring_fd : -1;
+}
+
+
+void uring_set_handler(const EUringOwner owner, const UringHandler_t handler)
+{
+    ring_handlers[owner] = handler;
+}
+
+
+struct io_uring_sqe* uring_sqe(const uint64_t data)
+{
+    const uint32_t tail = *sq_tail;
+    struct io_uring_sqe* sqe;
+
+    if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries)
+    {
+        uring_submit(); // Make room
+    }
+    sqe = &sqes[tail & sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = data;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE); // Not submitted before the next enter
+    sq_queued++;
+    return sqe;
+}
+
+
+void uring_submit(void)
+{
+    int submitted;
+
+    while (sq_queued != 0)
+    {
+        submitted = ring_enter(sq_queued, 0, 0, NULL, 0);
+        if (submitted < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        {
+            uring_reap(); // Completions may have to be taken first
+            continue;
+        }
+        if (submitted <= 0)
+        {
+            fprintf(stderr, "[ERR] Failed to submit IO requests. In \"uring.c::uring_submit\".\n");
+            sq_queued = 0;
+            destroy_ijvm_now();
+            return;
+        }
+        sq_queued -= (uint32_t)submitted;
+    }
+}
+
+
+bool uring_wait(const int32_t timeout)
+{
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    const uint32_t to_submit = sq_queued;
+    int result;
+
+    if (*cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        uring_submit();
+        uring_reap();
+        return true;
+    }
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeout >= 0)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    result = ring_enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (result > 0)
+    {
+        sq_queued -= (uint32_t)result < to_submit ? (uint32_t)result : to_submit;
+    }
+    uring_submit(); // Anything the kernel did not take yet
+    if (result < 0 && errno != EINTR && errno != ETIME)
+    {
+        fprintf(stderr, "[ERR] Failed to wait for IO requests. In \"uring.c::uring_wait\".\n");
+        destroy_ijvm_now();
+    }
+    if (*cq_head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    uring_reap();
+    return true;
+}
+
+
+void uring_reap(void)
+{
+    struct io_uring_cqe cqe;
+    uint32_t head = *cq_head;
+    EUringOwner owner;
+
+    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        cqe = cqes[head & cq_mask];
+        head++;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE); // Handlers may wait for more
+        owner = (EUringOwner)(cqe.user_data >> 56);
+        if (owner != URING_IGNORE && owner < URING_OWNERS && ring_handlers[owner] != NULL)
+        {
+            ring_handlers[owner](&cqe);
+        }
+        head = *cq_head;
+    }
+}
+
+
+bool uring_register_buffers(const struct iovec* iovs, const uint32_t num)
+{
+    return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iovs, num) == 0;
+}
+
+
+bool uring_provide_buffers(void)
+{
+    struct io_uring_buf_reg reg;
+    void* mem;
+
+    if (bufs_registered == true)
+    {
+        return true;
+    }
+    buf_ring_size = URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    mem = mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return false;
+    }
+    buf_ring = (struct io_uring_buf_ring*)mem;
+    bufs = (byte_t*)malloc((size_t)URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE);
+    if (bufs == NULL)
+    {
+        munmap(buf_ring, buf_ring_size);
+        buf_ring = NULL;
+        return false;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        munmap(buf_ring, buf_ring_size);
+        free(bufs);
+        buf_ring = NULL;
+        bufs = NULL;
+        return false; // Kernel older than 5.19
+    }
+    bufs_registered = true;
+    buf_tail = 0;
+    for (uint16_t i = 0; i < URING_RECV_BUFFERS; i++)
+    {
+        uring_recycle(i);
+    }
+    return true;
+}
+
+
+byte_t* uring_buffer(const uint16_t buf_id)
+{
+    return &bufs[(size_t)buf_id * URING_RECV_BUFFER_SIZE];
+}
+
+
+void uring_recycle(const uint16_t buf_id)
+{
+    struct io_uring_buf* buf = &buf_ring->bufs[buf_tail & (URING_RECV_BUFFERS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)uring_buffer(buf_id);
+    buf->len = URING_RECV_BUFFER_SIZE;
+    buf->bid = buf_id;
+    buf_tail++;
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+
+void uring_destroy(void)
+{
+    if (ring_state == 1)
+    {
+        uring_submit();
+    }
+
+    // The kernel lets go of the provided buffers with the ring
+    if (ring_fd >= 0)
+    {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (sqes != NULL)
+    {
+        munmap(sqes, sqes_size);
+        sqes = NULL;
+    }
+    if (cq_mem != NULL && cq_mem != sq_mem)
+    {
+        munmap(cq_mem, cq_mem_size);
+    }
+    cq_mem = NULL;
+    if (sq_mem != NULL)
+    {
+        munmap(sq_mem, sq_mem_size);
+        sq_mem = NULL;
+    }
+    if (buf_ring != NULL)
+    {
+        munmap(buf_ring, buf_ring_size);
+        buf_ring = NULL;
+    }
+    free(bufs);
+    bufs = NULL;
+    bufs_registered = false;
+    sq_queued = 0;
+    ring_state = -1;
+}
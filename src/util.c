@@ -140,6 +140,39 @@ const char* op_decode(const byte_t op)
     case OP_GC:
         return "GC";
         break;
+    case OP_ARRAYCOPY:
+        return "ARRAYCOPY";
+        break;
+    case OP_ARRAYFILL:
+        return "ARRAYFILL";
+        break;
+    case OP_NEWBYTEARRAY:
+        return "NEWBYTEARRAY";
+        break;
+    case OP_BALOAD:
+        return "BALOAD";
+        break;
+    case OP_BASTORE:
+        return "BASTORE";
+        break;
+    case OP_MULTINEWARRAY:
+        return "MULTINEWARRAY";
+        break;
+    case OP_MALOAD:
+        return "MALOAD";
+        break;
+    case OP_MASTORE:
+        return "MASTORE";
+        break;
+    case OP_INMAP:
+        return "INMAP";
+        break;
+    case OP_INARRAY:
+        return "INARRAY";
+        break;
+    case OP_OUTARRAY:
+        return "OUTARRAY";
+        break;
     case OP_NETBIND:
         return "NETBIND";
         break;
@@ -155,6 +188,36 @@ const char* op_decode(const byte_t op)
     case OP_NETCLOSE:
         return "NETCLOSE";
         break;
+    case OP_NETLISTEN:
+        return "NETLISTEN";
+        break;
+    case OP_NETACCEPT:
+        return "NETACCEPT";
+        break;
+    case OP_NETPOLL:
+        return "NETPOLL";
+        break;
+    case OP_NETINARRAY:
+        return "NETINARRAY";
+        break;
+    case OP_NETOUTARRAY:
+        return "NETOUTARRAY";
+        break;
+    case OP_SPAWN:
+        return "SPAWN";
+        break;
+    case OP_YIELD:
+        return "YIELD";
+        break;
+    case OP_JOIN:
+        return "JOIN";
+        break;
+    case OP_FUSED_IALOAD:
+        return "FUSED_IALOAD";
+        break;
+    case OP_FUSED_IASTORE:
+        return "FUSED_IASTORE";
+        break;
     default:
         return "NULL";
     }
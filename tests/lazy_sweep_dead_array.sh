@@ -0,0 +1,39 @@
+#!/bin/bash
+# A dead array whose slot is above the number of live arrays must not be accessible while the
+# lazy sweep that removes it is still pending.
+# Usage: tests/lazy_sweep_dead_array.sh [path to ijvm.bin] (depends on GC_PERIOD being 100)
+
+IJVM=${1:-build/ijvm.bin}
+PROGRAM=$(mktemp)
+trap 'rm -f "$PROGRAM"' EXIT
+
+{
+    printf '\x1d\xea\xdf\xad'                               # Magic number
+    printf '\x00\x01\x00\x00\x00\x00\x00\x10'               # Constant pool: 4 constants
+    printf '\x00\x00\x01\x2d'                               # 0: 301
+    printf '\x00\x00\x01\x2c'                               # 1: 300
+    printf '\xaa\x00\x12\xca'                               # 2: reference to the array in slot 300
+    printf '\x00\x00\x00\x01'                               # 3: 1
+    printf '\x00\x00\x00\x00\x00\x00\x00\x56'               # Text: 86 bytes
+    printf '\x13\x00\x00\xd1\x36\x00'                       # holder = NEWARRAY 301 (slot 0)
+    printf '\x10\x01\x36\x01'                               # i = 1
+    printf '\x10\x01\xd1\x15\x01\x15\x00\xd3'               # fill: holder[i] = NEWARRAY 1 (slot i)
+    printf '\x84\x01\x01\x15\x01\x13\x00\x00\x9f\x00\x06'   # i++, IF i == 301 GOTO filled
+    printf '\xa7\xff\xed'                                   # GOTO fill
+    printf '\x13\x00\x01\x15\x00\xd2\x36\x02'               # filled: a = holder[300]
+    printf '\x13\x00\x03\x15\x00\xd2\x36\x03'               # b = holder[1]
+    printf '\x15\x00\x10\x00\x13\x00\x00\x10\x00\xd6'       # ARRAYFILL holder 0..301 with 0
+    printf '\xd4'                                           # GC, only holder, a, and b are left
+    printf '\x10\x00\x36\x02\x10\x00\x36\x03'               # Drop a and b
+    printf '\x10\x01\xd1\x57\x10\x01\xd1\x57'               # 301 + 2 arrays created: lazy collection
+    printf '\x10\x00\x13\x00\x02\xd2\x57'                   # Load from a (b is swept first)
+    printf '\x10\x4f\xfd\xff'                               # OUT 'O', HALT
+} > "$PROGRAM"
+
+OUTPUT=$("$IJVM" "$PROGRAM" 2>&1)
+if [[ "$OUTPUT" != *"non-existent array"* ]]
+then
+    echo "FAIL: dead array was accessible: $OUTPUT"
+    exit 1
+fi
+echo "PASS"
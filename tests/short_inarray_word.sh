@@ -0,0 +1,30 @@
+#!/bin/bash
+# INARRAY into a word array that gets fewer bytes than asked for must leave the elements past the
+# number of bytes read unchanged.
+# Usage: tests/short_inarray_word.sh [path to ijvm.bin]
+
+IJVM=${1:-build/ijvm.bin}
+PROGRAM=$(mktemp)
+INPUT=$(mktemp)
+trap 'rm -f "$PROGRAM" "$INPUT"' EXIT
+
+{
+    printf '\x1d\xea\xdf\xad'                               # Magic number
+    printf '\x00\x01\x00\x00\x00\x00\x00\x04'               # Constant pool: 1 constant
+    printf '\x00\x00\x00\x00'                               # 0: 0 (unused)
+    printf '\x00\x00\x00\x00\x00\x00\x00\x1e'               # Text: 30 bytes
+    printf '\x10\x08\xd1\x36\x00'                           # a = NEWARRAY 8
+    printf '\x15\x00\x10\x00\x10\x08\x10\x37\xd6'           # ARRAYFILL a 0..8 with '7'
+    printf '\x15\x00\x10\x00\x10\x08\xde\x57'               # INARRAY a 0 8, only 2 bytes arrive
+    printf '\x15\x00\x10\x00\x10\x08\xdf'                   # OUTARRAY a 0 8
+    printf '\xff'                                           # HALT
+} > "$PROGRAM"
+printf 'AB' > "$INPUT"
+
+OUTPUT=$("$IJVM" "$PROGRAM" "$INPUT" 2>/dev/null)
+if [[ "$OUTPUT" != "AB777777"* ]]
+then
+    echo "FAIL: elements past the bytes read were changed: $OUTPUT"
+    exit 1
+fi
+echo "PASS"